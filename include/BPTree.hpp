@@ -17,6 +17,14 @@ struct IBPTreeStorage {
     virtual void free_node(NodeID id) = 0;
     virtual void free_val(Key key) = 0;
     virtual size_t get_node_size() const = 0;
+
+    // 写时复制: 被多棵树引用的节点不能原地修改. 默认节点不共享
+    virtual bool is_shared(NodeID) { return false; }
+    // 共享节点 id 已复制一份, children 为其子节点或叶子中的值, 之后由副本与原节点分别引用.
+    // 引用记录失败时返回 false
+    virtual bool on_copied(NodeID, std::span<const NodeID>) { return true; }
+    // 释放子树前调用: 节点仍被其它树引用时只减少一个引用并返回 true, 不再向下释放
+    virtual bool drop_shared(NodeID) { return false; }
 };
 
 template <typename Key, typename Val, size_t Blocksize>
@@ -27,6 +35,7 @@ struct BPTreeNode {
 
     uint64_t is_leaf;
     uint64_t key_cnt;
+    // 保留, 曾用于叶子链. 子树可被多棵树共享, 叶子之间不再相互链接
     Val nxt;
 
     Key keys[M];
@@ -59,29 +68,38 @@ public:
             return new_root_id.value();
         }
 
+        // 分裂途中分配失败会使树只分裂一半且丢掉键, 因此先按路径上已满的节点数
+        // 一次预留全部新节点, 预留失败时树保持不变
+        std::vector<Val> spare;
+        for (uint64_t need = splits_needed(root_id, key); spare.size() < need;) {
+            auto id = storage->allocate_node();
+            if (!id) {
+                for (Val s : spare)
+                    storage->free_node(s);
+                return std::nullopt;
+            }
+            spare.push_back(id.value());
+        }
+
         auto root_node_ptr = std::make_unique<Node>();
         storage->read_node(root_id, to_span(root_node_ptr.get()));
         Node *root_node = root_node_ptr.get();
 
         if (root_node->key_cnt == Node::M - 1) {
-            auto new_root_id = storage->allocate_node();
-            if (!new_root_id) {
-                return std::nullopt;
-            }
+            const Val new_root_id = spare.back();
+            spare.pop_back();
 
             auto new_root_ptr = std::make_unique<Node>();
             new_root_ptr->is_leaf = false;
             new_root_ptr->key_cnt = 0;
             new_root_ptr->vals[0] = root_id;
-            storage->write_node(new_root_id.value(), to_span(new_root_ptr.get()));
+            storage->write_node(new_root_id, to_span(new_root_ptr.get()));
 
-            if (!split_node(new_root_id.value(), 0)) {
-                return std::nullopt;
-            }
-            root_id = new_root_id.value();
+            split_node(new_root_id, 0, spare);
+            root_id = new_root_id;
         }
 
-        node_insert(root_id, key, val);
+        node_insert(root_id, key, val, spare);
         return root_id;
     }
 
@@ -114,8 +132,151 @@ public:
         return std::nullopt;
     }
 
+    // 从第一个 >= key 的位置起按键序收集至多 max_cnt 个键值对. 读完一个叶子后,
+    // 以下降途中记下的该叶子右边界重新从根下降到下一个叶子
+    std::vector<std::pair<Key, Val>> scan(Val root_id, Key key, size_t max_cnt) {
+        std::vector<std::pair<Key, Val>> rst;
+        if (root_id == 0 || max_cnt == 0)
+            return rst;
+
+        auto node_ptr = std::make_unique<Node>();
+        while (true) {
+            std::optional<Key> high;
+            Val cur_id = root_id;
+            while (true) {
+                storage->read_node(cur_id, to_span(node_ptr.get()));
+                if (node_ptr->is_leaf)
+                    break;
+                uint64_t idx = std::distance(
+                    node_ptr->keys,
+                    std::upper_bound(node_ptr->keys, node_ptr->keys + node_ptr->key_cnt, key));
+                if (idx < node_ptr->key_cnt)
+                    high = node_ptr->keys[idx];
+                cur_id = node_ptr->vals[idx];
+            }
+
+            Node *node = node_ptr.get();
+            uint64_t idx = std::distance(
+                node->keys, std::lower_bound(node->keys, node->keys + node->key_cnt, key));
+            for (; idx < node->key_cnt && rst.size() < max_cnt; idx++)
+                rst.emplace_back(node->keys[idx], node->vals[idx]);
+            if (rst.size() >= max_cnt || !high)
+                break;
+            key = high.value();
+        }
+        return rst;
+    }
+
+    // 仅从叶子中删除键并释放对应值, 不做节点合并 (空叶子保留在链上, 不影响查找与插入)
+    bool erase(Val root_id, Key key) {
+        if (root_id == 0)
+            return false;
+
+        auto node_ptr = std::make_unique<Node>();
+        Val cur_id = root_id;
+        Node *node = nullptr;
+
+        while (true) {
+            storage->read_node(cur_id, to_span(node_ptr.get()));
+            node = node_ptr.get();
+
+            if (node->is_leaf)
+                break;
+
+            uint64_t idx = std::distance(
+                node->keys, std::upper_bound(node->keys, node->keys + node->key_cnt, key));
+            cur_id = node->vals[idx];
+        }
+
+        auto it = std::lower_bound(node->keys, node->keys + node->key_cnt, key);
+        uint64_t idx = std::distance(node->keys, it);
+        if (idx >= node->key_cnt || node->keys[idx] != key)
+            return false;
+
+        storage->free_val(node->vals[idx]);
+        for (uint64_t i = idx; i + 1 < node->key_cnt; i++) {
+            node->keys[i] = node->keys[i + 1];
+            node->vals[i] = node->vals[i + 1];
+        }
+        node->key_cnt--;
+        node->keys[node->key_cnt] = 0;
+        node->vals[node->key_cnt] = 0;
+        storage->write_node(cur_id, to_span(node));
+        return true;
+    }
+
+    // 删除 [lo, hi) 内的全部键并释放对应值. 完全落在区间内的子树整棵释放并从父节点摘除,
+    // 根节点始终保留. 被修改的只有键 lo 与 hi 所在路径上的节点
+    void erase_range(Val root_id, Key lo, Key hi) {
+        if (root_id == 0 || lo >= hi)
+            return;
+        erase_range_node(root_id, std::nullopt, std::nullopt, lo, hi);
+    }
+
+    // 修改已有键对应的值, 键不存在时返回 false
+    bool update(Val root_id, Key key, Val val) {
+        if (root_id == 0)
+            return false;
+
+        auto node_ptr = std::make_unique<Node>();
+        Val cur_id = root_id;
+        Node *node = nullptr;
+
+        while (true) {
+            storage->read_node(cur_id, to_span(node_ptr.get()));
+            node = node_ptr.get();
+
+            if (node->is_leaf)
+                break;
+
+            uint64_t idx = std::distance(
+                node->keys, std::upper_bound(node->keys, node->keys + node->key_cnt, key));
+            cur_id = node->vals[idx];
+        }
+
+        auto it = std::lower_bound(node->keys, node->keys + node->key_cnt, key);
+        uint64_t idx = std::distance(node->keys, it);
+        if (idx >= node->key_cnt || node->keys[idx] != key)
+            return false;
+
+        node->vals[idx] = val;
+        storage->write_node(cur_id, to_span(node));
+        return true;
+    }
+
+    // 写时复制: 使从根到键 key 所在叶子的路径上的节点均可原地修改, 返回 (可能更换的) 根.
+    // 路径上被共享的节点各复制一份, 其子节点的引用由存储层记录, 只下推一级; 分配失败时返回
+    // nullopt, 此前已复制的节点保留在树中
+    std::optional<Val> unshare_path(Val root_id, Key key) {
+        if (root_id == 0)
+            return root_id;
+        auto root = unshare_node(root_id);
+        if (!root)
+            return std::nullopt;
+
+        auto node_ptr = std::make_unique<Node>();
+        Val cur_id = root.value();
+        while (true) {
+            storage->read_node(cur_id, to_span(node_ptr.get()));
+            if (node_ptr->is_leaf)
+                return root;
+            uint64_t idx = std::distance(
+                node_ptr->keys,
+                std::upper_bound(node_ptr->keys, node_ptr->keys + node_ptr->key_cnt, key));
+            auto child = unshare_node(node_ptr->vals[idx]);
+            if (!child)
+                return std::nullopt;
+            if (child.value() != node_ptr->vals[idx]) {
+                node_ptr->vals[idx] = child.value();
+                storage->write_node(cur_id, to_span(node_ptr.get()));
+            }
+            cur_id = child.value();
+        }
+    }
+
+    // 释放整棵子树; 仍被其它树引用的节点只减少引用
     void clear(Val id) {
-        if (id == 0)
+        if (id == 0 || storage->drop_shared(id))
             return;
         auto node_ptr = std::make_unique<Node>();
         storage->read_node(id, to_span(node_ptr.get()));
@@ -151,10 +312,92 @@ private:
         return std::span<uint8_t>(reinterpret_cast<uint8_t *>(node), Blocksize);
     }
 
-    bool split_node(Val father_id, uint64_t child_idx) {
-        auto newidopt = storage->allocate_node();
-        if (!newidopt)
-            return false;
+    // 节点 id 覆盖键区间 [low, high), nullopt 表示无界. 内部节点摘除子树时去掉其左侧分隔键,
+    // 该子树的键区间并入左邻 (位于最左时并入右邻)
+    void erase_range_node(Val id, std::optional<Key> low, std::optional<Key> high, Key lo,
+                          Key hi) {
+        auto node_ptr = std::make_unique<Node>();
+        storage->read_node(id, to_span(node_ptr.get()));
+        Node *node = node_ptr.get();
+
+        if (node->is_leaf) {
+            uint64_t first = std::distance(
+                node->keys, std::lower_bound(node->keys, node->keys + node->key_cnt, lo));
+            uint64_t last = std::distance(
+                node->keys, std::lower_bound(node->keys, node->keys + node->key_cnt, hi));
+            if (first == last)
+                return;
+            for (uint64_t i = first; i < last; i++)
+                storage->free_val(node->vals[i]);
+            const uint64_t old_cnt = node->key_cnt;
+            std::memmove(node->keys + first, node->keys + last, (old_cnt - last) * sizeof(Key));
+            std::memmove(node->vals + first, node->vals + last, (old_cnt - last) * sizeof(Val));
+            node->key_cnt -= last - first;
+            std::fill(node->keys + node->key_cnt, node->keys + old_cnt, Key{});
+            std::fill(node->vals + node->key_cnt, node->vals + old_cnt, Val{});
+            storage->write_node(id, to_span(node));
+            return;
+        }
+
+        auto kept_ptr = std::make_unique<Node>();
+        Node *kept = kept_ptr.get();
+        uint64_t kept_cnt = 0;
+        for (uint64_t i = 0; i <= node->key_cnt; i++) {
+            const std::optional<Key> child_low = i == 0 ? low : node->keys[i - 1];
+            const std::optional<Key> child_high = i == node->key_cnt ? high : node->keys[i];
+            if (child_low && child_high && *child_low >= lo && *child_high <= hi) {
+                clear(node->vals[i]);
+                continue;
+            }
+            if ((!child_high || *child_high > lo) && (!child_low || *child_low < hi))
+                erase_range_node(node->vals[i], child_low, child_high, lo, hi);
+            if (kept_cnt > 0)
+                kept->keys[kept_cnt - 1] = node->keys[i - 1];
+            kept->vals[kept_cnt++] = node->vals[i];
+        }
+        if (kept_cnt == node->key_cnt + 1)
+            return;
+        kept->is_leaf = false;
+        kept->key_cnt = kept_cnt - 1;
+        storage->write_node(id, to_span(kept));
+    }
+
+    // 节点不被共享时原样返回, 否则复制到新节点并返回新节点
+    std::optional<Val> unshare_node(Val id) {
+        if (!storage->is_shared(id))
+            return id;
+        auto new_id = storage->allocate_node();
+        if (!new_id)
+            return std::nullopt;
+        auto node_ptr = std::make_unique<Node>();
+        storage->read_node(id, to_span(node_ptr.get()));
+        storage->write_node(new_id.value(), to_span(node_ptr.get()));
+        const uint64_t cnt = node_ptr->is_leaf ? node_ptr->key_cnt : node_ptr->key_cnt + 1;
+        if (!storage->on_copied(id, std::span<const Val>(node_ptr->vals, cnt)))
+            return std::nullopt;
+        return new_id;
+    }
+
+    // 插入 key 需要的新节点数: 根已满时新根与分裂出的兄弟各一个, 下降路径上每个已满的
+    // 节点一个. 分裂只改变节点的兄弟, 不改变路径上的节点
+    uint64_t splits_needed(Val root_id, Key key) {
+        auto node_ptr = std::make_unique<Node>();
+        storage->read_node(root_id, to_span(node_ptr.get()));
+        uint64_t need = node_ptr->key_cnt == Node::M - 1 ? 2 : 0;
+        while (!node_ptr->is_leaf) {
+            uint64_t idx = std::distance(
+                node_ptr->keys,
+                std::upper_bound(node_ptr->keys, node_ptr->keys + node_ptr->key_cnt, key));
+            storage->read_node(node_ptr->vals[idx], to_span(node_ptr.get()));
+            need += node_ptr->key_cnt == Node::M - 1;
+        }
+        return need;
+    }
+
+    // 新节点取自 insert 预留的 spare
+    void split_node(Val father_id, uint64_t child_idx, std::vector<Val> &spare) {
+        const Val new_id = spare.back();
+        spare.pop_back();
 
         auto father_node_ptr = std::make_unique<Node>();
         storage->read_node(father_id, to_span(father_node_ptr.get()));
@@ -174,9 +417,6 @@ private:
             new_node.key_cnt = Node::M - 1 - mid;
             std::memcpy(new_node.keys, node->keys + mid, new_node.key_cnt * sizeof(Key));
             std::memcpy(new_node.vals, node->vals + mid, new_node.key_cnt * sizeof(Val));
-
-            new_node.nxt = node->nxt;
-            node->nxt = newidopt.value();
         } else {
             new_node.is_leaf = false;
             new_node.key_cnt = Node::M - 1 - mid - 1;
@@ -194,16 +434,14 @@ private:
             father_node->keys[i] = father_node->keys[i - 1];
 
         father_node->keys[insert_idx] = node->keys[mid];
-        father_node->vals[insert_idx + 1] = newidopt.value();
+        father_node->vals[insert_idx + 1] = new_id;
 
         storage->write_node(father_id, to_span(father_node));
         storage->write_node(node_id, to_span(node));
-        storage->write_node(newidopt.value(), to_span(&new_node));
-
-        return true;
+        storage->write_node(new_id, to_span(&new_node));
     }
 
-    bool node_insert(Val id, Key key, Val val) {
+    void node_insert(Val id, Key key, Val val, std::vector<Val> &spare) {
         auto node_ptr = std::make_unique<Node>();
         storage->read_node(id, to_span(node_ptr.get()));
         Node *node = node_ptr.get();
@@ -219,7 +457,7 @@ private:
             node->keys[insert_idx] = key;
             node->vals[insert_idx] = val;
             storage->write_node(id, to_span(node));
-            return true;
+            return;
         }
 
         uint64_t idx = std::distance(node->keys,
@@ -231,8 +469,7 @@ private:
         Node *child_node = child_node_ptr.get();
 
         if (child_node->key_cnt == Node::M - 1) {
-            if (!split_node(id, idx))
-                return false;
+            split_node(id, idx, spare);
 
             storage->read_node(id, to_span(node_ptr.get()));
             node = node_ptr.get(); // update pointer just in case
@@ -242,7 +479,7 @@ private:
             child_id = node->vals[idx];
         }
 
-        return node_insert(child_id, key, val);
+        node_insert(child_id, key, val, spare);
     }
 
 private:
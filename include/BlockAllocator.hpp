@@ -1,13 +1,54 @@
 #pragma once
+#include "BPTree.hpp"
 #include "IOContext.hpp"
+#include <algorithm>
+#include <mutex>
 #include <optional>
+#include <vector>
 
+class BlockAllocator;
+
+// 引用计数树的存储: 节点由位图直接分配, 值是计数而不是盘块, 无需释放
+class RefCountTreeAdapter : public IBPTreeStorage<uint64_t, uint64_t> {
+public:
+    RefCountTreeAdapter(std::shared_ptr<IOContext> _ioc, BlockAllocator *_alloc)
+        : ioc(_ioc), alloc(_alloc) {}
+    void read_node(uint64_t id, std::span<uint8_t> buffer) override {
+        std::memcpy(buffer.data(), ioc->read_block(id)->data(), buffer.size());
+    }
+    void write_node(uint64_t id, std::span<uint8_t> data) override {
+        std::memcpy(ioc->acquire_block(id)->data(), data.data(), data.size());
+    }
+    std::optional<uint64_t> allocate_node() override;
+    void free_node(uint64_t id) override;
+    void free_val(uint64_t) override {}
+    size_t get_node_size() const override { return BLOCK_SIZE; }
+
+private:
+    std::shared_ptr<IOContext> ioc;
+    BlockAllocator *alloc;
+};
+
+// 位图, 独占位图与引用计数树由同一把锁保护. 引用计数树的节点经本分配器分配, 锁需可重入
 class BlockAllocator {
+    using RefCountTree = BPTree<uint64_t, uint64_t, BLOCK_SIZE>;
+
 public:
     BlockAllocator(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IOContext> _ioc)
-        : sb(_sb), iocontext(_ioc) {}
+        : sb(_sb), iocontext(_ioc) {
+        refcnt_tree =
+            std::make_unique<RefCountTree>(std::make_shared<RefCountTreeAdapter>(iocontext, this));
+        iocontext->set_before_commit([this] { release_deferred(); });
+    }
+
+    ~BlockAllocator() {
+        iocontext->set_before_commit(nullptr);
+        release_deferred();
+    }
 
     void reset_bitmap() {
+        std::lock_guard lock(mtx);
+        deferred.clear();
         spdlog::debug("[Bitmap Manager] 写入位图.");
 
         std::shared_ptr<Buffer> buffer;
@@ -24,22 +65,26 @@ public:
         }
 
         //  部分1 Bitmap Block
-        buffer = iocontext->acquire_block(full_bitmap_blocks + sb->data.inode_block_start_lba);
+        buffer = iocontext->acquire_block(full_bitmap_blocks + sb->data.bitmap_block_start_lba);
         for (uint64_t i = 0; i < remaining_bytes; i++)
             (*buffer)[i] = 0xff;
         if (remaining_bits)
             (*buffer)[remaining_bytes] |= (0xff << (8 - remaining_bits));
 
-        // 全0 BitMap Block
+        // 全0 BitMap Block, 标记为未初始化, 首次访问时再视为全 0
         for (uint64_t i = full_bitmap_blocks + (remaining_bytes || remaining_bits);
              i < sb->data.bitmap_blocks_cnt; i++) {
+            if (sb->mark_block_uninit(i + sb->data.bitmap_block_start_lba))
+                continue;
             buffer = iocontext->acquire_block(i + sb->data.bitmap_block_start_lba);
             std::ranges::fill(*buffer, 0);
         }
+        reset_private();
         spdlog::debug("[Bitmap Manager] 完成位图写入.");
     }
 
     std::optional<uint64_t> allocate_block() {
+        std::lock_guard lock(mtx);
         spdlog::debug("[BitmapManager] 查找空闲盘块. 从索引 {} 开始",
                       sb->data.last_alloc_bitmap_blk_idx);
 
@@ -74,6 +119,7 @@ public:
                 uint64_t lba = bitmap_block_idx * sb->data.bits_per_block + byte_idx * 8 + bit_idx;
                 spdlog::debug("[BitmapManager] 找到空闲盘块, LBA: 0x{:X}", lba);
                 sb->data.free_blocks--;
+                mark_private(lba);
 
                 sb->data.last_alloc_bitmap_blk_idx = bitmap_block_idx;
                 return lba;
@@ -95,18 +141,212 @@ public:
         return std::nullopt;
     }
 
+    // 从上次分配的位置起找到第一个空闲盘块, 向后连续分配至多 max_cnt 个 (不跨位图块).
+    // 返回 (起始 LBA, 数量)
+    std::optional<std::pair<uint64_t, uint64_t>> allocate_run(uint64_t max_cnt) {
+        std::lock_guard lock(mtx);
+        spdlog::debug("[BitmapManager] 查找至多 {} 个连续空闲盘块.", max_cnt);
+        const uint64_t bits = sb->data.bits_per_block;
+        auto is_free = [](const Buffer &buffer, uint64_t bit) {
+            return !(buffer[bit / 8] & (1 << (7 - bit % 8)));
+        };
+
+        for (uint64_t i = 0; i < sb->data.bitmap_blocks_cnt && max_cnt > 0; i++) {
+            const uint64_t bitmap_block_idx =
+                (sb->data.last_alloc_bitmap_blk_idx + i) % sb->data.bitmap_blocks_cnt;
+            const uint64_t lba_base = bitmap_block_idx * bits;
+            const uint64_t end = std::min(bits, sb->data.total_blocks - lba_base);
+            std::shared_ptr<const Buffer> cur_buffer =
+                iocontext->read_block(bitmap_block_idx + sb->data.bitmap_block_start_lba);
+
+            uint64_t start = 0;
+            while (start < end && (*cur_buffer)[start / 8] == 0xff)
+                start += 8;
+            while (start < end && !is_free(*cur_buffer, start))
+                start++;
+            if (start >= end)
+                continue;
+            uint64_t cnt = 1;
+            while (cnt < max_cnt && start + cnt < end && is_free(*cur_buffer, start + cnt))
+                cnt++;
+
+            std::shared_ptr<Buffer> buffer =
+                iocontext->acquire_block(bitmap_block_idx + sb->data.bitmap_block_start_lba);
+            for (uint64_t bit = start; bit < start + cnt; bit++)
+                (*buffer)[bit / 8] |= (1 << (7 - bit % 8));
+            sb->data.free_blocks -= cnt;
+            mark_private(lba_base + start, cnt);
+            sb->data.last_alloc_bitmap_blk_idx = bitmap_block_idx;
+            spdlog::debug("[BitmapManager] 找到 {} 个连续空闲盘块, LBA: 0x{:X}", cnt,
+                          lba_base + start);
+            return std::make_pair(lba_base + start, cnt);
+        }
+
+        spdlog::warn("[BitmapManager] 未找到空闲盘块 (Disk Full).");
+        return std::nullopt;
+    }
+
+    // 分配 cnt 个连续且按 cnt 对齐的盘块, cnt 需为 8 的倍数且整除每个位图块的位数
+    std::optional<uint64_t> allocate_extent(uint64_t cnt) {
+        std::lock_guard lock(mtx);
+        spdlog::debug("[BitmapManager] 查找 {} 个连续空闲盘块.", cnt);
+        const uint64_t bytes = cnt / 8;
+
+        for (uint64_t bitmap_block_idx = 0; bitmap_block_idx < sb->data.bitmap_blocks_cnt;
+             bitmap_block_idx++) {
+            std::shared_ptr<const Buffer> cur_buffer =
+                iocontext->read_block(bitmap_block_idx + sb->data.bitmap_block_start_lba);
+            for (uint64_t byte_idx = 0; byte_idx + bytes <= sb->data.block_size;
+                 byte_idx += bytes) {
+                uint64_t lba = bitmap_block_idx * sb->data.bits_per_block + byte_idx * 8;
+                if (lba + cnt > sb->data.total_blocks)
+                    break;
+                if (!std::all_of(cur_buffer->begin() + byte_idx,
+                                 cur_buffer->begin() + byte_idx + bytes,
+                                 [](uint8_t b) { return b == 0; }))
+                    continue;
+
+                std::shared_ptr<Buffer> buffer =
+                    iocontext->acquire_block(bitmap_block_idx + sb->data.bitmap_block_start_lba);
+                std::fill_n(buffer->begin() + byte_idx, bytes, 0xff);
+                sb->data.free_blocks -= cnt;
+                mark_private(lba, cnt);
+                spdlog::debug("[BitmapManager] 找到连续空闲盘块, LBA: 0x{:X}", lba);
+                return lba;
+            }
+        }
+
+        spdlog::warn("[BitmapManager] 未找到 {} 个连续空闲盘块.", cnt);
+        return std::nullopt;
+    }
+
+    // 释放一个引用: 仍被其它文件引用时只减少计数; 仍被快照引用的盘块归快照所有,
+    // 当前文件系统只是放弃对它的引用
     void free_block(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        if (drop_ref(lba))
+            return;
+        if (held_by_snapshot(lba)) {
+            spdlog::debug("[BitmapManager] 盘块 0x{:X} 被快照引用, 不释放.", lba);
+            return;
+        }
+        release_block(lba);
+    }
+
+    // 直接清除位图中的分配位, 不检查引用. 经过日志的盘块 (元数据) 写入撤销记录,
+    // 分配位推迟到事务提交时清除, 以免提交前被当作数据块复用后又被重放覆盖
+    void release_block(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        sb->data.free_blocks++;
+        if (iocontext->revoke_block(lba)) {
+            deferred.push_back(lba);
+            return;
+        }
+        clear_bit(lba);
+    }
+
+    // 提交前清除推迟释放的盘块的分配位, 与撤销记录在同一事务中提交
+    void release_deferred() {
+        std::lock_guard lock(mtx);
+        for (uint64_t lba : deferred)
+            clear_bit(lba);
+        deferred.clear();
+    }
+
+    // 被多个文件引用或可能被快照引用的盘块修改前需先复制 (写时复制)
+    bool is_shared(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        return extra_refs(lba) > 0 || held_by_snapshot(lba);
+    }
+
+    // 引用计数树只记录被多处引用的盘块的额外引用数, 不在树中的已分配盘块只有一个引用者
+    uint64_t extra_refs(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        if (sb->data.refcount_root == 0)
+            return 0;
+        return refcnt_tree->find(sb->data.refcount_root, lba).value_or(0);
+    }
+
+    bool add_ref(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        if (uint64_t cnt = extra_refs(lba))
+            return refcnt_tree->update(sb->data.refcount_root, lba, cnt + 1);
+        auto root = refcnt_tree->insert(sb->data.refcount_root, lba, 1);
+        if (!root) {
+            spdlog::warn("[BitmapManager] 无法记录盘块 0x{:X} 的引用计数.", lba);
+            return false;
+        }
+        sb->data.refcount_root = root.value();
+        return true;
+    }
+
+    // 盘块有额外引用时减少一个并返回 true, 否则返回 false
+    bool drop_ref(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        const uint64_t cnt = extra_refs(lba);
+        if (cnt == 0)
+            return false;
+        if (cnt == 1)
+            refcnt_tree->erase(sb->data.refcount_root, lba);
+        else
+            refcnt_tree->update(sb->data.refcount_root, lba, cnt - 1);
+        return true;
+    }
+
+    // 存在快照时, 独占位图置位表示盘块在最近一次快照之后分配, 可原地修改;
+    // 其余已分配盘块可能被快照引用
+    bool held_by_snapshot(uint64_t lba) {
+        std::lock_guard lock(mtx);
+        if (sb->data.snapshots_cnt == 0)
+            return false;
+        std::shared_ptr<const Buffer> buffer =
+            iocontext->read_block(lba / sb->data.bits_per_block + sb->data.cow_bitmap_start_lba);
+        return !((*buffer)[(lba % sb->data.bits_per_block) / 8] & (1 << (7 - lba % 8)));
+    }
+
+    // 创建快照后当前全部盘块都变为共享: 独占位图整体标记为未初始化 (视为全 0)
+    void reset_private() {
+        std::lock_guard lock(mtx);
+        for (uint64_t i = 0; i < sb->data.cow_bitmap_blocks_cnt; i++) {
+            const uint64_t lba = i + sb->data.cow_bitmap_start_lba;
+            iocontext->invalidate_block(lba);
+            if (sb->mark_block_uninit(lba))
+                continue;
+            std::ranges::fill(*iocontext->acquire_block(lba), 0);
+        }
+    }
+
+private:
+    void clear_bit(uint64_t lba) {
         uint64_t bitmap_lba = lba / sb->data.bits_per_block + sb->data.bitmap_block_start_lba;
         uint64_t byte_idx = (lba % sb->data.bits_per_block) / 8;
         uint64_t bit_idx = lba % 8;
 
         std::shared_ptr<Buffer> buffer = iocontext->acquire_block(bitmap_lba);
         (*buffer)[byte_idx] &= ~((uint8_t)1 << (7 - bit_idx));
+    }
 
-        sb->data.free_blocks++;
+    void mark_private(uint64_t lba, uint64_t cnt = 1) {
+        if (sb->data.snapshots_cnt == 0)
+            return;
+        for (uint64_t i = lba; i < lba + cnt; i++) {
+            std::shared_ptr<Buffer> buffer =
+                iocontext->acquire_block(i / sb->data.bits_per_block + sb->data.cow_bitmap_start_lba);
+            (*buffer)[(i % sb->data.bits_per_block) / 8] |= (1 << (7 - i % 8));
+        }
     }
 
 private:
     std::shared_ptr<SuperBlock> sb;
     std::shared_ptr<IOContext> iocontext;
+    std::unique_ptr<RefCountTree> refcnt_tree;
+    std::recursive_mutex mtx;
+    // 已释放但分配位待提交时清除的盘块
+    std::vector<uint64_t> deferred;
 };
+
+inline std::optional<uint64_t> RefCountTreeAdapter::allocate_node() {
+    return alloc->allocate_block();
+}
+
+inline void RefCountTreeAdapter::free_node(uint64_t id) { alloc->release_block(id); }
@@ -21,6 +21,19 @@ public:
     void free_val(uint64_t val) override { alloc->free_block(val); }
     size_t get_node_size() const override { return BLOCK_SIZE; }
 
+    bool is_shared(uint64_t id) override { return alloc->is_shared(id); }
+    // 被其它文件引用的节点复制后, 子节点多了一个引用者; 只被快照引用时快照的引用不计数
+    bool on_copied(uint64_t id, std::span<const uint64_t> children) override {
+        if (alloc->extra_refs(id)) {
+            for (uint64_t child : children)
+                if (!alloc->add_ref(child))
+                    return false;
+        }
+        alloc->free_block(id);
+        return true;
+    }
+    bool drop_shared(uint64_t id) override { return alloc->drop_ref(id); }
+
 private:
     std::shared_ptr<IOContext> ioc;
     std::shared_ptr<BlockAllocator> alloc;
@@ -46,13 +59,33 @@ public:
         return btree->insert(root_lba, file_block_idx, file_data_lba);
     }
 
-    void free_node(uint64_t node_lba) {
-        if (node_lba == 0)
-            return;
-        btree->clear(node_lba);
+    std::vector<std::pair<uint64_t, uint64_t>> scan_blocks(uint64_t root_lba,
+                                                           uint64_t file_block_idx,
+                                                           size_t max_cnt) {
+        return btree->scan(root_lba, file_block_idx, max_cnt);
     }
 
-private:
+    bool erase_block(uint64_t root_lba, uint64_t file_block_idx) {
+        return btree->erase(root_lba, file_block_idx);
+    }
+
+    // 释放文件块号 [first, end) 内的全部数据块, 以及因此变空的索引节点
+    void erase_blocks(uint64_t root_lba, uint64_t first, uint64_t end) {
+        btree->erase_range(root_lba, first, end);
+    }
+
+    bool update_block(uint64_t root_lba, uint64_t file_block_idx, uint64_t file_data_lba) {
+        return btree->update(root_lba, file_block_idx, file_data_lba);
+    }
+
+    // 修改第 file_block_idx 块的映射前复制路径上被共享的节点, 返回新根
+    std::optional<uint64_t> unshare_path(uint64_t root_lba, uint64_t file_block_idx) {
+        return btree->unshare_path(root_lba, file_block_idx);
+    }
+
+    // 释放索引树, 与其它文件共享的子树只减少其根节点的引用计数
+    void free_node(uint64_t node_lba) { btree->clear(node_lba); }
+
 private:
     std::shared_ptr<SuperBlock> sb;
     std::shared_ptr<IOContext> iocontext;
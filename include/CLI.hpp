@@ -226,22 +226,37 @@ public:
                 }
                 uint64_t fd = fd_opt.value();
 
-                const size_t buf_size = 1024;
-                std::vector<uint8_t> buffer(buf_size);
-                while (true) {
-                    size_t n = filesys->read(fd, buffer);
-                    if (n == 0)
-                        break;
-                    for (size_t i = 0; i < n; ++i) {
-                        if (buffer[i] == 0) {
-                            buffer[i] = '.';
-                        }
+                for (auto it = filesys->data_iter(fd).value(); it.valid(); it.next()) {
+                    auto view = it.block();
+                    size_t run = 0;
+                    for (size_t i = 0; i <= view.size(); ++i) {
+                        if (i < view.size() && view[i] != 0)
+                            continue;
+                        std::cout.write(reinterpret_cast<const char *>(view.data() + run), i - run);
+                        if (i < view.size())
+                            std::cout.put('.');
+                        run = i + 1;
                     }
-                    std::cout.write(reinterpret_cast<char *>(buffer.data()), n);
                 }
                 std::cout << "\n";
                 filesys->close(fd);
 
+            } else if (original_cmd == "truncate") {
+                if (args.size() != 3) {
+                    std::cout << "Usage: truncate <filename> <size>\n";
+                    continue;
+                }
+                auto size_opt = str2unum(args[2]);
+                if (!size_opt) {
+                    std::cout << "Invalid size: " << args[2] << "\n";
+                    continue;
+                }
+                if (filesys->truncate(path_join(args[0], args[1]), size_opt.value()))
+                    std::cout << "Truncated " << args[1] << " to " << size_opt.value()
+                              << " bytes.\n";
+                else
+                    std::cout << "Failed to truncate file: " << args[1] << "\n";
+
             } else if (original_cmd == "mkdirn") {
                 if (args.size() != 3) {
                     std::cout << "Usage: mkdirn <name_prefix> <count>\n";
@@ -253,19 +268,11 @@ public:
                     continue;
                 }
 
-                std::string prefix = args[1];
-                uint64_t n = n_opt.value();
-                int success_count = 0;
-
-                for (uint64_t i = 0; i < n; ++i) {
-                    std::string name = prefix + std::to_string(i);
-                    if (filesys->create_dir(args[0] + "/" + name)) {
-                        success_count++;
-                    } else {
-                        std::cout << "Failed to create directory: " << name << "\n";
-                    }
-                }
-                std::cout << "Batch created " << success_count << " directories.\n";
+                std::vector<std::string> names;
+                for (uint64_t i = 0; i < n_opt.value(); ++i)
+                    names.push_back(args[1] + std::to_string(i));
+                size_t created = filesys->mkdir_many(args[0], names);
+                std::cout << "Batch created " << created << " directories.\n";
 
             } else if (original_cmd == "touchn") {
                 if (args.size() != 3) {
@@ -278,19 +285,28 @@ public:
                     continue;
                 }
 
-                std::string prefix = args[1];
-                uint64_t n = n_opt.value();
-                int success_count = 0;
+                std::vector<std::string> names;
+                for (uint64_t i = 0; i < n_opt.value(); ++i)
+                    names.push_back(args[1] + std::to_string(i));
+                size_t created = filesys->create_many(args[0], names);
+                std::cout << "Batch created " << created << " files.\n";
 
-                for (uint64_t i = 0; i < n; ++i) {
-                    std::string name = prefix + std::to_string(i);
-                    if (filesys->create_file(args[0] + "/" + name)) {
-                        success_count++;
-                    } else {
-                        std::cout << "Failed to create file: " << name << "\n";
-                    }
+            } else if (original_cmd == "rmn") {
+                if (args.size() != 3) {
+                    std::cout << "Usage: rmn <name_prefix> <count>\n";
+                    continue;
+                }
+                auto n_opt = str2unum(args[2]);
+                if (!n_opt) {
+                    std::cout << "Invalid number: " << args[2] << "\n";
+                    continue;
                 }
-                std::cout << "Batch created " << success_count << " files.\n";
+
+                std::vector<std::string> names;
+                for (uint64_t i = 0; i < n_opt.value(); ++i)
+                    names.push_back(args[1] + std::to_string(i));
+                size_t removed = filesys->remove_many(args[0], names);
+                std::cout << "Batch removed " << removed << " entries.\n";
 
             } else {
                 std::cout << "Unknown command: " << original_cmd << "\n";
@@ -313,9 +329,11 @@ private:
         std::cout << "  read <fd> <size>        Read from file descriptor\n";
         std::cout << "  write <fd> <content>    Write to file descriptor\n";
         std::cout << "  seek <fd> <offset>      Seek to offset in file\n";
+        std::cout << "  truncate <name> <size>  Shrink or extend file\n";
         std::cout << "  format                  Format file system\n";
         std::cout << "  mkdirn <prefix> <n>     Batch create directories\n";
         std::cout << "  touchn <prefix> <n>     Batch create files\n";
+        std::cout << "  rmn <prefix> <n>        Batch remove entries\n";
         std::cout << "  exit                    Exit the system\n";
         std::cout << "  help                    Show this help message\n";
     }
@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 #include <string>
@@ -55,6 +56,7 @@ public:
 
     void clear() override {
         spdlog::info("[VDisk] 清空虚拟硬盘.");
+        std::lock_guard lock(mtx);
 
         if (file.is_open()) {
             file.close();
@@ -82,6 +84,7 @@ public:
 
         uint64_t offset = lba * block_size;
 
+        std::lock_guard lock(mtx);
         file.clear();
         file.seekg(offset, std::ios::beg);
 
@@ -95,6 +98,27 @@ public:
         }
     }
 
+    void read_blocks(uint64_t lba, uint64_t cnt, char *buffer) override {
+        spdlog::trace("[VDisk] 从虚拟硬盘连续读取 {} 个盘块. LBA: 0x{:X}.", cnt, lba);
+        if (lba + cnt > get_expected_size_bytes() / block_size) {
+            throw std::out_of_range("LBA 超出虚拟硬盘范围");
+        }
+
+        const uint64_t size = cnt * block_size;
+        std::lock_guard lock(mtx);
+        file.clear();
+        file.seekg(lba * block_size, std::ios::beg);
+
+        if (!file.read(buffer, size)) {
+            if (file.eof() || file.gcount() < static_cast<std::streamsize>(size)) {
+                std::memset(buffer + file.gcount(), 0, size - file.gcount());
+                file.clear();
+            } else {
+                spdlog::error("[VDisk] 连续读取虚拟硬盘失败 LBA: 0x{:X}.", lba);
+            }
+        }
+    }
+
     void write_block(uint64_t lba, const char *data) override {
         spdlog::trace("[VDisk] 向虚拟硬盘写入盘块. LBA: 0x{:X}.", lba);
         if (lba >= get_expected_size_bytes() / block_size) {
@@ -103,12 +127,16 @@ public:
 
         uint64_t offset = lba * block_size;
 
+        std::lock_guard lock(mtx);
         file.clear();
         file.seekp(offset, std::ios::beg);
         file.write(data, block_size);
     }
 
-    void flush() override { file.flush(); }
+    void flush() override {
+        std::lock_guard lock(mtx);
+        file.flush();
+    }
 
 private:
     void open_stream() {
@@ -120,6 +148,8 @@ private:
     }
 
 private:
+    // 文件流的读写位置是共享状态, 定位与读写须整体互斥
+    std::mutex mtx;
     std::fstream file;
     std::string disk_path;
 };
@@ -2,31 +2,37 @@
 #include "BlockAllocator.hpp"
 #include "IDisk.hpp"
 #include "INode.hpp"
+#include "INodeLocks.hpp"
 #include "INodeTable.hpp"
 #include "IOContext.hpp"
+#include "IOExecutor.hpp"
 #include "SuperBlock.hpp"
+#include <atomic>
+#include <bit>
 #include <cstdint>
 #include <filesystem>
 #include <format>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 struct FileHandle {
     uint64_t inode_id;
-    uint64_t offset;
+    std::atomic<uint64_t> offset;
 };
 
+// 可被多个线程同时调用. 每个操作持有操作锁的共享模式, 并按 INode 加读写锁: 读取持共享锁,
+// 修改持独占锁, 目录操作先锁父目录再锁目录项. 提交, 快照与格式化持有操作锁的独占模式
 class FileSys {
 public:
     FileSys(std::shared_ptr<IDisk> _disk) : disk(_disk) {
         spdlog::info("[FileSys] 文件系统启动.");
-        sb = std::make_shared<SuperBlock>();
-        iocontext = std::make_shared<IOContext>(sb, disk);
-        blkalloc = std::make_shared<BlockAllocator>(sb, iocontext);
-        blkidxer = std::make_shared<BlockIndexer>(sb, iocontext, blkalloc);
-        inodetable = std::make_shared<INodeTable>(sb, iocontext, blkalloc, blkidxer);
+        init_components();
 
         iocontext->read_super_block();
 
@@ -35,12 +41,32 @@ public:
             format();
             spdlog::info("[FileSys] 重新读取Super Block.");
             iocontext->read_super_block();
+        } else if (uint64_t replayed = iocontext->recover()) {
+            spdlog::info("[FileSys] 日志重放完成, 共 {} 个事务.", replayed);
         }
 
         debug_super_block_info();
     }
     ~FileSys() {}
 
+    // 以只读方式挂载第 idx 个快照, 可与当前文件系统同时挂载在同一硬盘上. 失败时返回 nullptr
+    static std::shared_ptr<FileSys> open_snapshot(std::shared_ptr<IDisk> disk, uint64_t idx) {
+        spdlog::info("[FileSys] 只读挂载快照 {}.", idx);
+        std::shared_ptr<FileSys> fs(new FileSys(disk, ReadOnlyTag{}));
+        fs->iocontext->read_super_block();
+        if (!fs->sb->valid() || idx >= fs->sb->data.snapshots_cnt) {
+            spdlog::error("[FileSys] 快照 {} 不存在.", idx);
+            return nullptr;
+        }
+        disk->read_block(fs->sb->data.snapshot_lbas[idx], reinterpret_cast<char *>(fs->sb.get()));
+        if (!fs->sb->valid()) {
+            spdlog::error("[FileSys] 快照 {} 记录损坏.", idx);
+            return nullptr;
+        }
+        fs->debug_super_block_info();
+        return fs;
+    }
+
     void debug_super_block_info() {
         spdlog::debug("[FileSys] 硬盘Super Block信息:");
         spdlog::debug("[FileSys] Magic Number: 0x{:X}.", sb->data.magic_number);
@@ -57,14 +83,19 @@ public:
         spdlog::debug("[FileSys] INode Valid Block Start LBA: 0x{:X}.",
                       sb->data.inode_valid_block_start_lba);
         spdlog::debug("[FileSys] INode Valid Blocks Count: {}.", sb->data.inode_valid_blocks_cnt);
-        spdlog::debug("[FileSys] INode Block Start LBA: 0x{:X}.", sb->data.inode_block_start_lba);
-        spdlog::debug("[FileSys] INode Blocks Count: {}.", sb->data.inode_blocks_cnt);
+        spdlog::debug("[FileSys] INode Chunk Map Start LBA: 0x{:X}.",
+                      sb->data.inode_chunk_map_start_lba);
+        spdlog::debug("[FileSys] INode Chunks: {} / {}.", sb->data.allocated_inode_chunks,
+                      sb->data.inode_chunks_cnt);
         spdlog::debug("[FileSys] Basic Blocks Count: {}.", sb->data.basic_blocks_cnt);
         spdlog::debug("[FileSys] Root INode: 0x{:X}.", sb->data.root_inode_id);
         spdlog::debug("[FileSys] Free Blocks: {}.", sb->data.free_blocks);
     }
 
     void format() {
+        if (!writable())
+            return;
+        ExclusiveGuard guard(this);
         spdlog::info("[FileSys] 进行硬盘格式化.");
 
         spdlog::debug("[FileSys] 清空硬盘.");
@@ -74,9 +105,11 @@ public:
         spdlog::debug("[FileSys] 写入Super Block.");
         *sb = create_superblock(disk->get_disk_size());
         iocontext->flush_super_block();
+        iocontext->format_journal();
 
         spdlog::debug("[FileSys] 写入bitmap.");
         blkalloc->reset_bitmap();
+        fragalloc->reset();
 
         spdlog::debug("[FileSys] 写入INode bitmap.");
         inodetable->reset_inode_bitmap();
@@ -84,13 +117,16 @@ public:
         spdlog::debug("[FileSys] 创建根目录.");
         create_root_dir();
 
-        iocontext->flush_super_block();
         inodetable->flush();
+        iocontext->flush_all();
 
         spdlog::info("[FileSys] 格式化完成.");
     }
 
     bool create_dir(std::string path_str) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
         std::filesystem::path path(path_str);
 
         if (path.has_relative_path() && !path.has_filename()) {
@@ -114,25 +150,34 @@ public:
             return false;
         }
         uint64_t parent_id = parent_id_opt.value();
+        auto parent_lock = locks.lock(parent_id);
+        if (!is_live_dir(parent_id)) {
+            spdlog::error("[FileSys] 创建目录失败: 父目录不存在 {}", parent_path_str);
+            return false;
+        }
 
         if (inodetable->find_inode_by_name(parent_id, name).has_value()) {
             spdlog::warn("[FileSys] 创建目录失败: 目标已存在 {}/{}", parent_path_str, name);
             return false;
         }
 
-        auto dir_id_opt = inodetable->allocate_inode(FileType::Directory);
+        auto dir_id_opt = inodetable->allocate_inode(FileType::Directory, parent_id);
         if (!dir_id_opt) {
             spdlog::error("[FileSys] 创建目录失败: Inode 耗尽");
             return false;
         }
         uint64_t new_inode_id = dir_id_opt.value();
 
-        inodetable->add_diritem(new_inode_id, ".", new_inode_id);
-        inodetable->add_diritem(new_inode_id, "..", parent_id);
+        const std::pair<std::string, uint64_t> self[] = {{".", new_inode_id}, {"..", parent_id}};
+        if (!inodetable->add_diritems(new_inode_id, self)) {
+            spdlog::error("[FileSys] 创建目录失败: 写入目录项失败");
+            inodetable->free_inode(new_inode_id);
+            return false;
+        }
 
         if (!inodetable->add_diritem(parent_id, name, new_inode_id)) {
             spdlog::error("[FileSys] 创建目录失败: 写入父目录失败");
-            inodetable->free_inode(new_inode_id);
+            inodetable->free_unlinked_dir(new_inode_id, parent_id);
             return false;
         }
 
@@ -140,21 +185,35 @@ public:
     }
 
     bool remove_file(std::string path_str) {
-        if (!has_file(path_str))
+        if (!writable())
             return false;
+        OpGuard guard(this);
         std::filesystem::path path(path_str);
 
         std::string name = path.filename().string();
         std::string parent = path.parent_path().string();
 
+        // "." 与 ".." 指向父目录自身或其上级, 按父先子后的顺序无法加锁, 也不允许删除
+        if (name == "." || name == "..")
+            return false;
         auto path_inode = lookup_path(parent);
         if (!path_inode)
             return false;
 
+        auto parent_lock = locks.lock(path_inode.value());
+        auto target = inodetable->find_inode_by_name(path_inode.value(), name);
+        if (!target || !is_live_dir(path_inode.value()))
+            return false;
+        auto target_lock = locks.lock(target.value());
+        if (inodetable->get_attr(target.value()).file_type != FileType::File)
+            return false;
         return inodetable->remove_diritem(path_inode.value(), name);
     }
 
     bool remove_dir(std::string path_str) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
         if (path_str.empty())
             return false;
 
@@ -166,31 +225,141 @@ public:
         std::string name = path.filename().string();
         std::string parent = path.parent_path().string();
 
+        if (name == "." || name == "..")
+            return false;
         auto path_inode = lookup_path(parent);
         if (!path_inode)
             return false;
 
+        auto parent_lock = locks.lock(path_inode.value());
+        auto target = inodetable->find_inode_by_name(path_inode.value(), name);
+        if (!target || !is_live_dir(path_inode.value()))
+            return false;
+        auto target_lock = locks.lock(target.value());
         return inodetable->remove_diritem(path_inode.value(), name);
     }
 
-    void list_directory(std::string path) {
-        spdlog::info("[FileSys] 列出目录项 path:{}.", path);
+    size_t remove_many(std::string dir_path, const std::vector<std::string> &names) {
+        if (!writable())
+            return 0;
+        OpGuard guard(this);
+        spdlog::info("[FileSys] 批量删除目录项 path:{}, 数量:{}.", dir_path, names.size());
+        auto dir_id = lookup_path(dir_path);
+        if (!dir_id)
+            return 0;
+        auto dir_lock = locks.lock(dir_id.value());
+        if (!is_live_dir(dir_id.value()))
+            return 0;
+
+        // 父目录已独占锁定, 目录项不会再变化; 被删除的目录项按 id 升序逐个锁定
+        std::unordered_set<std::string> targets(names.begin(), names.end());
+        targets.erase(".");
+        targets.erase("..");
+        std::vector<uint64_t> ids;
+        DirCursor cursor(dir_id.value(), inodetable->data_iter(dir_id.value()));
+        for (auto items = cursor.next_batch(); !items.empty(); items = cursor.next_batch())
+            for (const auto &item : items)
+                if (targets.count(item.name))
+                    ids.push_back(item.inode_id);
+        std::ranges::sort(ids);
+        std::vector<INodeLocks<>::Guard> target_locks;
+        for (uint64_t id : ids)
+            target_locks.push_back(locks.lock(id));
+        return inodetable->remove_many(dir_id.value(), names);
+    }
+
+    // 在同一目录下批量创建文件或目录: 父目录只解析并扫描一次, INode 一次分配,
+    // 目录项一次写入. 已存在, 重复或非法的名字被跳过, 返回实际创建的数量
+    size_t create_many(std::string dir_path, const std::vector<std::string> &names) {
+        return create_many_as(dir_path, names, FileType::File);
+    }
+
+    size_t mkdir_many(std::string dir_path, const std::vector<std::string> &names) {
+        return create_many_as(dir_path, names, FileType::Directory);
+    }
+
+    // 批量查询同一目录下各名字的属性, 不存在的名字对应 nullopt
+    std::vector<std::optional<INodeAttr>> stat_many(std::string dir_path,
+                                                    const std::vector<std::string> &names) {
+        OpGuard guard(this);
+        std::vector<std::optional<INodeAttr>> rst(names.size());
+        auto dir_id = lookup_path(dir_path);
+        if (!dir_id)
+            return rst;
+
+        std::vector<size_t> found;
+        std::vector<uint64_t> ids;
+        {
+            auto dir_lock = locks.lock_shared(dir_id.value());
+            if (!is_live_dir(dir_id.value()))
+                return rst;
+            // 目录项中的名字按 filename_size 截断保存, 查找前同样截断
+            auto existing = dir_entries(dir_id.value());
+            for (size_t i = 0; i < names.size(); i++) {
+                auto it = existing.find(names[i].substr(0, sb->data.filename_size - 1));
+                if (it != existing.end()) {
+                    found.push_back(i);
+                    ids.push_back(it->second);
+                }
+            }
+        }
+
+        std::vector<INodeAttr> attrs;
+        read_attrs(ids, attrs);
+        for (size_t i = 0; i < found.size(); i++)
+            rst[found[i]] = attrs[i];
+        return rst;
+    }
+
+    // 游标只在取下一批时短暂持有目录的共享锁, 本批目录项在锁内复制, 不受之后的并发修改影响
+    std::optional<DirCursor> opendir(std::string path) {
+        OpGuard guard(this);
         auto node_id = lookup_path(path);
         if (!node_id)
+            return std::nullopt;
+        auto lock = locks.lock_shared(node_id.value());
+        if (inodetable->get_attr(node_id.value()).file_type != FileType::Directory)
+            return std::nullopt;
+        return DirCursor(node_id.value(), inodetable->data_iter(node_id.value()));
+    }
+
+    // 每次返回一个目录块内的目录项, 视图在下一次 readdir 前有效, 空视图表示结束
+    std::span<const DirItem> readdir(DirCursor &cursor) {
+        OpGuard guard(this);
+        auto lock = locks.lock_shared(cursor.dir_id());
+        return cursor.copy_batch();
+    }
+
+    // readdirplus: 同时批量取回本批目录项对应的 INode 属性
+    std::span<const DirItem> readdir_plus(DirCursor &cursor, std::vector<INodeAttr> &attrs) {
+        OpGuard guard(this);
+        std::span<const DirItem> items;
+        std::vector<uint64_t> ids;
+        {
+            auto lock = locks.lock_shared(cursor.dir_id());
+            items = cursor.copy_batch();
+            ids.reserve(items.size());
+            for (const auto &item : items)
+                ids.push_back(item.inode_id);
+        }
+
+        read_attrs(ids, attrs);
+        return items;
+    }
+
+    void list_directory(std::string path) {
+        spdlog::info("[FileSys] 列出目录项 path:{}.", path);
+        auto cursor = opendir(path);
+        if (!cursor)
             return;
-        INode node = inodetable->get_inode_info(node_id.value());
-        const uint64_t epoch_num = 1024;
-        for (uint64_t offset = 0; offset < node.size; offset += epoch_num * sb->data.diritem_size) {
-            std::vector<uint8_t> buffer(epoch_num * sb->data.diritem_size);
-            auto size = inodetable->read_data(node_id.value(), offset, buffer);
-            buffer.resize(size);
-            for (auto i = 0; i < buffer.size(); i += sb->data.diritem_size) {
-                DirItem *item = reinterpret_cast<DirItem *>(buffer.data() + i);
-                INode node = inodetable->get_inode_info(item->inode_id);
-                std::cout << std::format("{} {} {}\n", item->inode_id, node.size, item->name);
-            }
-            std::cout << "\n";
+        std::vector<INodeAttr> attrs;
+        for (auto items = readdir_plus(*cursor, attrs); !items.empty();
+             items = readdir_plus(*cursor, attrs)) {
+            for (size_t i = 0; i < items.size(); i++)
+                std::cout << std::format("{} {} {}\n", items[i].inode_id, attrs[i].size,
+                                         items[i].name);
         }
+        std::cout << "\n";
     }
 
     // TODO:
@@ -224,6 +393,9 @@ public:
     }
 
     bool create_file(std::string path_str) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
         std::filesystem::path path(path_str);
 
         if (path.has_relative_path() && !path.has_filename()) {
@@ -247,13 +419,18 @@ public:
             return false;
         }
         uint64_t parent_id = parent_id_opt.value();
+        auto parent_lock = locks.lock(parent_id);
+        if (!is_live_dir(parent_id)) {
+            spdlog::error("[FileSys] 创建文件失败: 父目录不存在 {}", parent_path_str);
+            return false;
+        }
 
         if (inodetable->find_inode_by_name(parent_id, name).has_value()) {
             spdlog::warn("[FileSys] 创建文件失败: 目标已存在 {}/{}", parent_path_str, name);
             return false;
         }
 
-        auto file_id_opt = inodetable->allocate_inode(FileType::File);
+        auto file_id_opt = inodetable->allocate_inode(FileType::File, parent_id);
         if (!file_id_opt) {
             spdlog::error("[FileSys] 创建文件失败: Inode 耗尽");
             return false;
@@ -269,74 +446,554 @@ public:
         return true;
     }
 
+    // 克隆文件: dst 与 src 共享数据块与索引树, 只增加引用计数, 之后任一方写入时再复制.
+    // 创建与克隆在同一操作内完成, 期间持有父目录与 src 的锁, 失败时不留下空的 dst
+    bool clone_file(std::string src, std::string dst) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        spdlog::info("[FileSys] 克隆文件 {} -> {}.", src, dst);
+        std::filesystem::path path(dst);
+        if (path.has_relative_path() && !path.has_filename())
+            path = path.parent_path();
+        std::string name = path.filename().string();
+        std::string parent_path_str = path.parent_path().string();
+        if (name.empty() || name == "." || name == "..") {
+            spdlog::error("[FileSys] 克隆文件失败: 目标文件名非法 {}", dst);
+            return false;
+        }
+
+        auto src_id = lookup_path(src);
+        auto parent_id = lookup_path(parent_path_str);
+        if (!src_id || !parent_id ||
+            inodetable->get_attr(src_id.value()).file_type != FileType::File) {
+            spdlog::error("[FileSys] 克隆文件失败: 源文件或目标父目录不存在");
+            return false;
+        }
+        // 先父目录后文件, 与删除文件的加锁顺序一致; 加锁后再次确认源仍是文件
+        auto parent_lock = locks.lock(parent_id.value());
+        auto src_lock = locks.lock_shared(src_id.value());
+        if (!is_live_dir(parent_id.value()) ||
+            inodetable->get_attr(src_id.value()).file_type != FileType::File) {
+            spdlog::error("[FileSys] 克隆文件失败: 源文件或目标父目录不存在");
+            return false;
+        }
+        if (inodetable->find_inode_by_name(parent_id.value(), name).has_value()) {
+            spdlog::warn("[FileSys] 克隆文件失败: 目标已存在 {}", dst);
+            return false;
+        }
+
+        // 新 INode 在写入目录项前对其他操作不可见, 无需加锁
+        auto dst_id = inodetable->allocate_inode(FileType::File, parent_id.value());
+        if (!dst_id) {
+            spdlog::error("[FileSys] 克隆文件失败: Inode 耗尽");
+            return false;
+        }
+        if (!inodetable->clone_data(src_id.value(), dst_id.value()) ||
+            !inodetable->add_diritem(parent_id.value(), name, dst_id.value())) {
+            spdlog::error("[FileSys] 克隆文件失败: 空间不足");
+            inodetable->free_inode(dst_id.value());
+            return false;
+        }
+        return true;
+    }
+
     std::optional<uint64_t> open(std::string path, uint64_t offset = 0) {
+        OpGuard guard(this);
         auto inode_id_opt = lookup_path(path);
         if (!inode_id_opt) {
             return std::nullopt;
         }
         auto inode_id = inode_id_opt.value();
 
-        INode node = inodetable->get_inode_info(inode_id);
-        if (node.file_type != FileType::File) {
-            return std::nullopt;
+        {
+            auto lock = locks.lock_shared(inode_id);
+            if (inodetable->get_attr(inode_id).file_type != FileType::File)
+                return std::nullopt;
         }
 
         uint64_t fd = cur_fd++;
-        fd_table[fd] = FileHandle{.inode_id = inode_id, .offset = offset};
+        std::unique_lock lock(fd_mtx);
+        fd_table[fd] = std::make_shared<FileHandle>(inode_id, offset);
 
         return fd;
     }
 
     void close(uint64_t fd) {
-        if (fd_table.find(fd) == fd_table.end())
-            return;
+        std::unique_lock lock(fd_mtx);
         fd_table.erase(fd);
     }
 
+    // 同一句柄上的并发读写各自取得偏移后推进, 互不保证顺序
     bool write(uint64_t fd, std::span<uint8_t> data) {
-        if (!fd_table.count(fd))
+        auto handle = get_handle(fd);
+        if (!handle)
             return false;
-        auto &handle = fd_table[fd];
-
-        bool success = inodetable->write_data(handle.inode_id, handle.offset, data);
+        bool success = pwrite(fd, handle->offset, data);
         if (success) {
-            handle.offset += data.size();
+            handle->offset += data.size();
         }
         return success;
     }
 
     size_t read(uint64_t fd, std::span<uint8_t> buffer) {
-        if (!fd_table.count(fd))
+        auto handle = get_handle(fd);
+        if (!handle)
+            return 0;
+        auto size = pread(fd, handle->offset, buffer);
+        handle->offset += size;
+        return size;
+    }
+
+    // 在指定偏移处读写, 不读取也不移动句柄偏移; 多个线程可在同一句柄上各自随机读写
+    size_t pread(uint64_t fd, uint64_t offset, std::span<uint8_t> buffer) {
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return 0;
+        auto lock = locks.lock_shared(handle->inode_id);
+        return inodetable->read_data(handle->inode_id, offset, buffer);
+    }
+
+    bool pwrite(uint64_t fd, uint64_t offset, std::span<const uint8_t> data) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return false;
+        auto lock = locks.lock(handle->inode_id);
+        return inodetable->write_data(handle->inode_id, offset, data);
+    }
+
+    // 向量化读写: iov 中的各段对应文件中的一段连续区间, 整个请求只取一次 INode 并只遍历一次索引
+    size_t readv(uint64_t fd, std::span<const std::span<uint8_t>> iov) {
+        auto handle = get_handle(fd);
+        if (!handle)
             return 0;
-        auto &handle = fd_table[fd];
-        auto size = inodetable->read_data(handle.inode_id, handle.offset, buffer);
-        handle.offset += size;
+        auto size = preadv(fd, handle->offset, iov);
+        handle->offset += size;
         return size;
     }
 
+    bool writev(uint64_t fd, std::span<const std::span<const uint8_t>> iov) {
+        auto handle = get_handle(fd);
+        if (!handle)
+            return false;
+        bool success = pwritev(fd, handle->offset, iov);
+        if (success) {
+            for (auto buf : iov)
+                handle->offset += buf.size();
+        }
+        return success;
+    }
+
+    size_t preadv(uint64_t fd, uint64_t offset, std::span<const std::span<uint8_t>> iov) {
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return 0;
+        auto lock = locks.lock_shared(handle->inode_id);
+        return inodetable->read_data(handle->inode_id, offset, iov);
+    }
+
+    bool pwritev(uint64_t fd, uint64_t offset, std::span<const std::span<const uint8_t>> iov) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return false;
+        auto lock = locks.lock(handle->inode_id);
+        return inodetable->write_data(handle->inode_id, offset, iov);
+    }
+
+    // 预留 [offset, offset + len) 的盘块并按需扩展文件大小, 预留部分读出全零. 不移动句柄偏移
+    bool fallocate(uint64_t fd, uint64_t offset, uint64_t len) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return false;
+        auto lock = locks.lock(handle->inode_id);
+        return inodetable->allocate_range(handle->inode_id, offset, len);
+    }
+
+    // 把文件截断或延长到 size, 缩短时释放超出部分占用的数据块与索引节点. 不移动句柄偏移
+    bool truncate(std::string path, uint64_t size) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        auto inode_id = lookup_path(path);
+        if (!inode_id)
+            return false;
+        auto lock = locks.lock(inode_id.value());
+        if (inodetable->get_attr(inode_id.value()).file_type != FileType::File)
+            return false;
+        return inodetable->truncate(inode_id.value(), size);
+    }
+
+    bool truncate(uint64_t fd, uint64_t size) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return false;
+        auto lock = locks.lock(handle->inode_id);
+        return inodetable->truncate(handle->inode_id, size);
+    }
+
+    // 释放 [offset, offset + len) 内的整块, 区间读出全零而文件大小不变
+    bool punch_hole(uint64_t fd, uint64_t offset, uint64_t len) {
+        if (!writable())
+            return false;
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return false;
+        auto lock = locks.lock(handle->inode_id);
+        return inodetable->punch_hole(handle->inode_id, offset, len);
+    }
+
+    // 协程接口: co_await 后由执行器的工作线程调用 open/pread/pwrite 并在该线程上恢复,
+    // 语义与同步调用相同. 调用方需保证缓冲区在完成前有效
+    auto async_open(std::string path) {
+        return IOAwaitable(io_executor(), [this, path = std::move(path)] { return open(path); });
+    }
+
+    auto async_read(uint64_t fd, uint64_t offset, std::span<uint8_t> buffer) {
+        return IOAwaitable(io_executor(), [=, this] { return pread(fd, offset, buffer); });
+    }
+
+    auto async_write(uint64_t fd, uint64_t offset, std::span<const uint8_t> data) {
+        return IOAwaitable(io_executor(), [=, this] { return pwrite(fd, offset, data); });
+    }
+
+    // 把 fd_in 的 [off_in, off_in + len) 复制到 fd_out 的 off_out 处, 不移动两个句柄的偏移.
+    // 返回复制的字节数
+    size_t copy_range(uint64_t fd_in, uint64_t off_in, uint64_t fd_out, uint64_t off_out,
+                      uint64_t len) {
+        if (!writable())
+            return 0;
+        OpGuard guard(this);
+        auto in = get_handle(fd_in);
+        auto out = get_handle(fd_out);
+        if (!in || !out)
+            return 0;
+        auto [first_lock, second_lock] = lock_pair(in->inode_id, true, out->inode_id);
+        return inodetable->copy_range(in->inode_id, off_in, out->inode_id, off_out, len);
+    }
+
+    // 从句柄当前偏移起按块零拷贝遍历文件内容, 不移动句柄偏移.
+    // 迭代器不持有锁, 遍历期间文件被并发写入时可能看到写入前后混合的内容
+    std::optional<INodeDataIterator> data_iter(uint64_t fd) {
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return std::nullopt;
+        auto lock = locks.lock_shared(handle->inode_id);
+        return inodetable->data_iter(handle->inode_id, handle->offset);
+    }
+
     void seek(uint64_t fd, uint64_t offset) {
-        if (!fd_table.count(fd))
-            return;
-        fd_table[fd].offset = offset;
+        if (auto handle = get_handle(fd))
+            handle->offset = offset;
+    }
+
+    // 类似 lseek 的 SEEK_DATA / SEEK_HOLE: 把句柄偏移移到 offset 之后下一段数据 / 空洞的起点并
+    // 返回该位置, 文件末尾视为空洞. 只查索引不读数据块, 备份等工具可据此跳过空洞.
+    // offset 之后再无数据或 offset 不小于文件大小时返回 nullopt, 句柄偏移不变
+    std::optional<uint64_t> seek_data(uint64_t fd, uint64_t offset) {
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return std::nullopt;
+        auto lock = locks.lock_shared(handle->inode_id);
+        auto pos = inodetable->seek_data(handle->inode_id, offset);
+        if (pos)
+            handle->offset = pos.value();
+        return pos;
+    }
+
+    std::optional<uint64_t> seek_hole(uint64_t fd, uint64_t offset) {
+        OpGuard guard(this);
+        auto handle = get_handle(fd);
+        if (!handle)
+            return std::nullopt;
+        auto lock = locks.lock_shared(handle->inode_id);
+        auto pos = inodetable->seek_hole(handle->inode_id, offset);
+        if (pos)
+            handle->offset = pos.value();
+        return pos;
     }
 
+    // 提交运行中的事务, 返回后此前完成的操作均已持久化
+    void sync() {
+        ExclusiveGuard guard(this);
+        inodetable->flush();
+        iocontext->commit();
+    }
+
+    // 只原地回写该文件的脏数据块与 INode, 再提交运行中的事务 (含其索引树节点) 并 flush 硬盘,
+    // 其它文件的脏数据块留在缓存中
+    bool fsync(uint64_t fd) {
+        if (read_only)
+            return true;
+        {
+            OpGuard guard(this);
+            auto handle = get_handle(fd);
+            if (!handle)
+                return false;
+            auto lock = locks.lock_shared(handle->inode_id);
+            inodetable->flush_file(handle->inode_id);
+        }
+        ExclusiveGuard guard(this);
+        iocontext->commit_durable();
+        return true;
+    }
+
+    // INode 中没有时间戳, 大小与块映射都是读回数据所必需的元数据, 因此与 fsync 相同
+    bool fdatasync(uint64_t fd) { return fsync(fd); }
+
+    // 创建快照并返回其编号. 快照冻结当前根目录与 INode 块组映射 (映射表复制一份),
+    // 之后对共享盘块的修改均写时复制到新盘块, 快照内容保持不变
+    std::optional<uint64_t> snapshot() {
+        if (!writable())
+            return std::nullopt;
+        ExclusiveGuard guard(this);
+        if (sb->data.snapshots_cnt >= MAX_SNAPSHOTS) {
+            spdlog::error("[FileSys] 创建快照失败: 快照数已达上限 {}", MAX_SNAPSHOTS);
+            return std::nullopt;
+        }
+        inodetable->flush();
+        iocontext->flush_all();
+
+        // 快照记录块后紧跟映射表副本, 一次分配连续盘块, 多余的尾部立即归还
+        const uint64_t map_blocks = sb->data.inode_chunk_map_blocks_cnt;
+        const uint64_t extent = std::max<uint64_t>(8, std::bit_ceil(map_blocks + 1));
+        auto lba_opt = blkalloc->allocate_extent(extent);
+        if (!lba_opt) {
+            spdlog::error("[FileSys] 创建快照失败: 空间不足");
+            return std::nullopt;
+        }
+        const uint64_t lba = lba_opt.value();
+        for (uint64_t i = map_blocks + 1; i < extent; i++)
+            blkalloc->free_block(lba + i);
+
+        for (uint64_t i = 0; i < map_blocks; i++) {
+            auto src = iocontext->read_block(sb->data.inode_chunk_map_start_lba + i);
+            std::memcpy(iocontext->acquire_block(lba + 1 + i)->data(), src->data(),
+                        sb->data.block_size);
+        }
+        auto record = iocontext->acquire_block(lba);
+        std::memcpy(record->data(), sb.get(), sizeof(SuperBlock));
+        auto snap = reinterpret_cast<SuperBlock *>(record->data());
+        snap->data.inode_chunk_map_start_lba = lba + 1;
+        snap->data.snapshots_cnt = 0;
+        std::ranges::fill(snap->data.snapshot_lbas, 0);
+
+        const uint64_t idx = sb->data.snapshots_cnt++;
+        sb->data.snapshot_lbas[idx] = lba;
+        blkalloc->reset_private();
+        fragalloc->seal();
+        iocontext->flush_all();
+
+        spdlog::info("[FileSys] 创建快照 {}, LBA: 0x{:X}.", idx, lba);
+        return idx;
+    }
+
+    uint64_t snapshots_cnt() const { return sb->data.snapshots_cnt; }
+
     bool has_dir(std::string path) {
+        OpGuard guard(this);
         auto inode_id_opt = lookup_path(path);
         if (!inode_id_opt)
             return false;
-        INode inode = inodetable->get_inode_info(inode_id_opt.value());
-        return inode.file_type == FileType::Directory;
+        auto lock = locks.lock_shared(inode_id_opt.value());
+        return inodetable->get_attr(inode_id_opt.value()).file_type == FileType::Directory;
     }
 
     bool has_file(std::string path) {
+        OpGuard guard(this);
         auto inode_id_opt = lookup_path(path);
         if (!inode_id_opt)
             return false;
-        INode inode = inodetable->get_inode_info(inode_id_opt.value());
-        return inode.file_type == FileType::File;
+        auto lock = locks.lock_shared(inode_id_opt.value());
+        return inodetable->get_attr(inode_id_opt.value()).file_type == FileType::File;
     }
 
 private:
+    struct ReadOnlyTag {};
+
+    FileSys(std::shared_ptr<IDisk> _disk, ReadOnlyTag) : disk(_disk), read_only(true) {
+        init_components();
+        iocontext->set_read_only();
+    }
+
+    void init_components() {
+        sb = std::make_shared<SuperBlock>();
+        iocontext = std::make_shared<IOContext>(sb, disk);
+        blkalloc = std::make_shared<BlockAllocator>(sb, iocontext);
+        blkidxer = std::make_shared<BlockIndexer>(sb, iocontext, blkalloc);
+        fragalloc = std::make_shared<FragmentAllocator>(sb, iocontext, blkalloc);
+        inodetable = std::make_shared<INodeTable>(sb, iocontext, blkalloc, blkidxer, fragalloc);
+    }
+
+    bool writable() const {
+        if (read_only)
+            spdlog::error("[FileSys] 只读挂载, 拒绝修改.");
+        return !read_only;
+    }
+
+    // 操作期间持有操作锁的共享模式; 结束时检查运行中的事务, 累积足够多的盘块后统一组提交.
+    // 进入前先经过 gate_mtx, 等待中的独占方占住它, 使其不会被源源不断的新操作饿死
+    class OpGuard {
+    public:
+        OpGuard(FileSys *_fs) : fs(_fs) {
+            { std::lock_guard gate(fs->gate_mtx); }
+            fs->op_mtx.lock_shared();
+        }
+        ~OpGuard() {
+            fs->op_mtx.unlock_shared();
+            if (fs->iocontext->need_commit())
+                fs->sync();
+        }
+
+    private:
+        FileSys *fs;
+    };
+
+    // 提交与快照需要一致的缓存内容, 等待进行中的操作全部结束, 期间不接受新操作
+    class ExclusiveGuard {
+    public:
+        ExclusiveGuard(FileSys *fs) : gate(fs->gate_mtx), lock(fs->op_mtx) {}
+
+    private:
+        std::lock_guard<std::mutex> gate;
+        std::lock_guard<std::shared_mutex> lock;
+    };
+
+    std::shared_ptr<FileHandle> get_handle(uint64_t fd) {
+        std::shared_lock lock(fd_mtx);
+        auto it = fd_table.find(fd);
+        return it == fd_table.end() ? nullptr : it->second;
+    }
+
+    // 同时锁定两个文件: first 按 first_shared 加共享或独占锁, second 加独占锁, 按 id 升序获取.
+    // 二者相同时只加一把独占锁
+    std::pair<INodeLocks<>::Guard, INodeLocks<>::Guard> lock_pair(uint64_t first,
+                                                                  bool first_shared,
+                                                                  uint64_t second) {
+        if (first == second)
+            return {locks.lock(second), INodeLocks<>::Guard()};
+        auto lock_first = [&] { return first_shared ? locks.lock_shared(first) : locks.lock(first); };
+        if (first < second) {
+            auto a = lock_first();
+            return {std::move(a), locks.lock(second)};
+        }
+        auto b = locks.lock(second);
+        return {lock_first(), std::move(b)};
+    }
+
+    // 执行器在首次异步调用时创建
+    IOExecutor *io_executor() {
+        std::call_once(executor_once, [this] {
+            executor = std::make_unique<IOExecutor>(
+                std::max(1u, std::thread::hardware_concurrency()), ASYNC_IO_QUEUE_DEPTH);
+        });
+        return executor.get();
+    }
+
+    size_t create_many_as(std::string dir_path, const std::vector<std::string> &names,
+                          FileType type) {
+        if (!writable())
+            return 0;
+        OpGuard guard(this);
+        spdlog::info("[FileSys] 批量创建 path:{}, 数量:{}.", dir_path, names.size());
+        auto dir_id_opt = lookup_path(dir_path);
+        if (!dir_id_opt) {
+            spdlog::error("[FileSys] 批量创建失败: 父目录不存在 {}", dir_path);
+            return 0;
+        }
+        const uint64_t dir_id = dir_id_opt.value();
+        auto dir_lock = locks.lock(dir_id);
+        if (!is_live_dir(dir_id)) {
+            spdlog::error("[FileSys] 批量创建失败: 父目录不存在 {}", dir_path);
+            return 0;
+        }
+
+        // 目录项中的名字按 filename_size 截断保存, 查重前同样截断
+        auto existing = dir_entries(dir_id);
+        std::vector<std::pair<std::string, uint64_t>> items;
+        for (const auto &name : names) {
+            if (name.empty() || name == "." || name == ".." ||
+                name.find('/') != std::string::npos)
+                continue;
+            std::string stored = name.substr(0, sb->data.filename_size - 1);
+            if (existing.emplace(stored, 0).second)
+                items.emplace_back(std::move(stored), 0);
+        }
+        if (items.empty())
+            return 0;
+
+        auto ids = inodetable->allocate_inodes(type, dir_id, items.size());
+        std::vector<std::pair<std::string, uint64_t>> created;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (type == FileType::Directory) {
+                const std::pair<std::string, uint64_t> self[] = {{".", ids[i]}, {"..", dir_id}};
+                if (!inodetable->add_diritems(ids[i], self)) {
+                    spdlog::error("[FileSys] 批量创建 {} 失败: 写入目录项失败", items[i].first);
+                    inodetable->free_inode(ids[i]);
+                    continue;
+                }
+            }
+            created.emplace_back(std::move(items[i].first), ids[i]);
+        }
+        if (created.empty())
+            return 0;
+        if (!inodetable->add_diritems(dir_id, created)) {
+            spdlog::error("[FileSys] 批量创建失败: 写入父目录失败");
+            for (auto &[name, id] : created) {
+                if (type == FileType::Directory)
+                    inodetable->free_unlinked_dir(id, dir_id);
+                else
+                    inodetable->free_inode(id);
+            }
+            return 0;
+        }
+        return created.size();
+    }
+
+    // 目录中全部目录项的名字到 INode 的映射, 调用方需持有目录的锁
+    std::unordered_map<std::string, uint64_t> dir_entries(uint64_t dir_id) {
+        std::unordered_map<std::string, uint64_t> entries;
+        DirCursor cursor(dir_id, inodetable->data_iter(dir_id));
+        for (auto items = cursor.next_batch(); !items.empty(); items = cursor.next_batch())
+            for (const auto &item : items)
+                entries.emplace(item.name, item.inode_id);
+        return entries;
+    }
+
+    // ids 中可能包含 ".." 与子目录, 同时持有多把锁会与父先子后的顺序冲突, 逐个加锁读取.
+    // 按 id 顺序访问使同一 INode 块内的未命中只读盘一次
+    void read_attrs(const std::vector<uint64_t> &ids, std::vector<INodeAttr> &attrs) {
+        std::vector<size_t> order(ids.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::sort(order, {}, [&](size_t i) { return ids[i]; });
+        attrs.resize(ids.size());
+        for (size_t i : order) {
+            auto lock = locks.lock_shared(ids[i]);
+            attrs[i] = inodetable->get_attr(ids[i]);
+        }
+    }
+
+    // 父目录在查找之后, 加锁之前可能已被删除 (INode 清零, 类型变为普通文件)
+    bool is_live_dir(uint64_t id) {
+        return inodetable->get_attr(id).file_type == FileType::Directory;
+    }
+
     void create_root_dir() {
         spdlog::info("[FileSys] 创建根目录.");
         sb->data.root_inode_id = inodetable->allocate_inode(FileType::Directory).value();
@@ -360,7 +1017,11 @@ private:
                 name = path.substr(0, idx);
                 path = path.substr(idx + 1);
             }
-            auto optid = inodetable->find_inode_by_name(cur_node_id, name);
+            std::optional<uint64_t> optid;
+            {
+                auto lock = locks.lock_shared(cur_node_id);
+                optid = inodetable->find_inode_by_name(cur_node_id, name);
+            }
             if (!optid)
                 return std::nullopt;
             cur_node_id = optid.value();
@@ -375,7 +1036,19 @@ private:
     std::shared_ptr<BlockAllocator> blkalloc;
     std::shared_ptr<INodeTable> inodetable;
     std::shared_ptr<BlockIndexer> blkidxer;
+    std::shared_ptr<FragmentAllocator> fragalloc;
+
+    bool read_only = false;
+
+    std::mutex gate_mtx;
+    std::shared_mutex op_mtx;
+    INodeLocks<> locks;
+
+    std::atomic<uint64_t> cur_fd = 0;
+    std::shared_mutex fd_mtx;
+    std::unordered_map<uint64_t, std::shared_ptr<FileHandle>> fd_table;
 
-    uint64_t cur_fd = 0;
-    std::unordered_map<uint64_t, FileHandle> fd_table;
+    // 最先析构, 保证队列中剩余的请求在各组件仍有效时完成
+    std::once_flag executor_once;
+    std::unique_ptr<IOExecutor> executor;
 };
@@ -1,6 +1,7 @@
 #pragma once
-#include <string>
+#include <cstddef>
 #include <cstdint>
+#include <string>
 
 // FNV-1a constants for 64-bit
 const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
@@ -16,3 +17,13 @@ inline uint64_t fnv1a_hash(const std::string& str) {
 
     return hash;
 }
+
+// 增量计算任意字节序列的哈希, 可将上一段的结果作为 hash 继续累加
+inline uint64_t fnv1a_hash(const void *data, size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
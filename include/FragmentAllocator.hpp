@@ -0,0 +1,197 @@
+#pragma once
+#include "BPTree.hpp"
+#include "BlockAllocator.hpp"
+#include "IOContext.hpp"
+#include "macros.hpp"
+#include <array>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+
+// 碎片表的存储: 节点由位图直接分配, 值是占用位图而不是盘块, 无需释放
+class FragmentTreeAdapter : public IBPTreeStorage<uint64_t, uint64_t> {
+public:
+    FragmentTreeAdapter(std::shared_ptr<IOContext> _ioc, std::shared_ptr<BlockAllocator> _alloc)
+        : ioc(_ioc), alloc(_alloc) {}
+    void read_node(uint64_t id, std::span<uint8_t> buffer) override {
+        std::memcpy(buffer.data(), ioc->read_block(id)->data(), buffer.size());
+    }
+    void write_node(uint64_t id, std::span<uint8_t> data) override {
+        std::memcpy(ioc->acquire_block(id)->data(), data.data(), data.size());
+    }
+    std::optional<uint64_t> allocate_node() override { return alloc->allocate_block(); }
+    void free_node(uint64_t id) override { alloc->release_block(id); }
+    void free_val(uint64_t) override {}
+    size_t get_node_size() const override { return BLOCK_SIZE; }
+
+private:
+    std::shared_ptr<IOContext> ioc;
+    std::shared_ptr<BlockAllocator> alloc;
+};
+
+// 小文件碎片分配器. 碎片块是从位图分配的普通盘块, 等分为 FRAGMENTS_PER_BLOCK 个碎片,
+// 多个小文件各占其中连续的若干碎片. 各碎片块的占用位图记在以 LBA 为键的碎片表 (B+ 树) 中,
+// 与盘块位图分开; 首次使用时载入内存, 未满的碎片块按块内最长的空闲连续碎片数分桶
+class FragmentAllocator {
+    using FragmentTree = BPTree<uint64_t, uint64_t, BLOCK_SIZE>;
+    static constexpr uint64_t FullMask = (1ull << FRAGMENTS_PER_BLOCK) - 1;
+
+public:
+    FragmentAllocator(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IOContext> _ioc,
+                      std::shared_ptr<BlockAllocator> _blkalloc)
+        : sb(_sb), blkalloc(_blkalloc) {
+        tree = std::make_unique<FragmentTree>(std::make_shared<FragmentTreeAdapter>(_ioc, _blkalloc));
+    }
+
+    // 格式化后碎片表为空, 丢弃内存中的副本
+    void reset() {
+        std::lock_guard lock(mtx);
+        loaded = false;
+        masks.clear();
+        for (auto &bucket : by_run)
+            bucket.clear();
+        sealed.clear();
+        last_lba = 0;
+    }
+
+    // 分配 cnt 个连续碎片, 返回 (碎片块 LBA, 起始碎片号). 优先使用最近分配过的碎片块,
+    // 使先后创建的小文件聚在同一块中; 否则取最长空闲连续碎片数不小于 cnt 的首个桶
+    std::optional<std::pair<uint64_t, uint64_t>> allocate(uint64_t cnt) {
+        std::lock_guard lock(mtx);
+        load();
+        if (auto idx = take(last_lba, cnt))
+            return std::make_pair(last_lba, idx.value());
+        for (uint64_t run = cnt; run <= FRAGMENTS_PER_BLOCK; run++) {
+            if (by_run[run].empty())
+                continue;
+            last_lba = *by_run[run].begin();
+            return std::make_pair(last_lba, take(last_lba, cnt).value());
+        }
+
+        auto lba = blkalloc->allocate_block();
+        if (!lba)
+            return std::nullopt;
+        auto root = tree->insert(sb->data.fragment_root, lba.value(), 0);
+        if (!root) {
+            blkalloc->free_block(lba.value());
+            return std::nullopt;
+        }
+        sb->data.fragment_root = root.value();
+        spdlog::debug("[FragmentAllocator] 新碎片块 0x{:X}.", lba.value());
+        masks[lba.value()] = 0;
+        by_run[FRAGMENTS_PER_BLOCK].insert(lba.value());
+        last_lba = lba.value();
+        return std::make_pair(lba.value(), take(lba.value(), cnt).value());
+    }
+
+    // 原位把 [idx, idx + cnt) 扩展为 [idx, idx + new_cnt), 其后的碎片已被占用时返回 false
+    bool extend(uint64_t lba, uint64_t idx, uint64_t cnt, uint64_t new_cnt) {
+        std::lock_guard lock(mtx);
+        load();
+        const uint64_t bits = run_mask(idx + cnt, new_cnt - cnt);
+        if (idx + new_cnt > FRAGMENTS_PER_BLOCK || (masks[lba] & bits) || sealed.count(lba))
+            return false;
+        set_mask(lba, masks[lba] | bits);
+        return true;
+    }
+
+    // 释放 [idx, idx + cnt), 碎片块全空时从碎片表中删除并释放盘块
+    void free(uint64_t lba, uint64_t idx, uint64_t cnt) {
+        std::lock_guard lock(mtx);
+        load();
+        const uint64_t mask = masks[lba] & ~run_mask(idx, cnt);
+        if (mask != 0) {
+            set_mask(lba, mask);
+            return;
+        }
+        tree->erase(sb->data.fragment_root, lba);
+        by_run[longest_run(masks[lba])].erase(lba);
+        masks.erase(lba);
+        sealed.erase(lba);
+        blkalloc->free_block(lba);
+        spdlog::debug("[FragmentAllocator] 释放碎片块 0x{:X}.", lba);
+        // 删除不合并节点, 碎片表变空时整棵释放
+        if (masks.empty()) {
+            tree->clear(sb->data.fragment_root);
+            sb->data.fragment_root = 0;
+        }
+    }
+
+    // 创建快照后调用: 现有碎片块均被快照引用, 块内剩余的空闲碎片不能再写入,
+    // 一次性全部移出分配桶, 之后分配时无需逐块检查是否共享
+    void seal() {
+        std::lock_guard lock(mtx);
+        load();
+        for (auto &bucket : by_run)
+            bucket.clear();
+        for (auto [lba, mask] : masks)
+            sealed.insert(lba);
+    }
+
+private:
+    static uint64_t run_mask(uint64_t idx, uint64_t cnt) { return ((1ull << cnt) - 1) << idx; }
+
+    // mask 中最长的连续空闲碎片数, 满块为 0
+    static uint64_t longest_run(uint64_t mask) {
+        uint64_t longest = 0, run = 0;
+        for (uint64_t idx = 0; idx < FRAGMENTS_PER_BLOCK; idx++) {
+            run = (mask >> idx & 1) ? 0 : run + 1;
+            longest = std::max(longest, run);
+        }
+        return longest;
+    }
+
+    // 挂载后首次使用时载入, 此时被快照引用的碎片块逐块检查一次
+    void load() {
+        if (loaded)
+            return;
+        loaded = true;
+        if (sb->data.fragment_root == 0)
+            return;
+        for (auto [lba, mask] : tree->scan(sb->data.fragment_root, 0, SIZE_MAX)) {
+            masks[lba] = mask;
+            if (sb->data.snapshots_cnt && blkalloc->is_shared(lba))
+                sealed.insert(lba);
+            else if (mask != FullMask)
+                by_run[longest_run(mask)].insert(lba);
+        }
+    }
+
+    // 在碎片块 lba 中首次适配 cnt 个连续空闲碎片
+    std::optional<uint64_t> take(uint64_t lba, uint64_t cnt) {
+        auto it = masks.find(lba);
+        if (it == masks.end() || sealed.count(lba))
+            return std::nullopt;
+        const uint64_t mask = it->second;
+        for (uint64_t idx = 0; idx + cnt <= FRAGMENTS_PER_BLOCK; idx++) {
+            if (mask & run_mask(idx, cnt))
+                continue;
+            set_mask(lba, mask | run_mask(idx, cnt));
+            return idx;
+        }
+        return std::nullopt;
+    }
+
+    void set_mask(uint64_t lba, uint64_t mask) {
+        tree->update(sb->data.fragment_root, lba, mask);
+        uint64_t &cur = masks[lba];
+        by_run[longest_run(cur)].erase(lba);
+        cur = mask;
+        if (mask != FullMask && !sealed.count(lba))
+            by_run[longest_run(mask)].insert(lba);
+    }
+
+private:
+    std::shared_ptr<SuperBlock> sb;
+    std::shared_ptr<BlockAllocator> blkalloc;
+    std::unique_ptr<FragmentTree> tree;
+
+    std::mutex mtx;
+    bool loaded = false;
+    std::map<uint64_t, uint64_t> masks;
+    // by_run[n]: 最长空闲连续碎片数为 n 的未满碎片块, 不含 sealed 中的块
+    std::array<std::set<uint64_t>, FRAGMENTS_PER_BLOCK + 1> by_run;
+    std::set<uint64_t> sealed;
+    uint64_t last_lba = 0;
+};
@@ -0,0 +1,561 @@
+#pragma once
+#include "BPTree.hpp"
+#include "IDisk.hpp"
+#include "INode.hpp"
+#include "INodeTable.hpp"
+#include "SuperBlock.hpp"
+#include <atomic>
+#include <bit>
+#include <format>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct FsckReport {
+    uint64_t errors = 0;
+    std::vector<std::string> messages;
+
+    uint64_t inodes_checked = 0;
+    uint64_t blocks_referenced = 0;
+};
+
+// 离线只读检查镜像. 位图与 INode 块组以大块顺序读入, INode 解析与 B+ 树遍历按块组分给
+// 多个线程并行进行; 硬盘读取本身在锁内串行
+class FsChecker {
+    using Node = BPTreeNode<uint64_t, uint64_t, BLOCK_SIZE>;
+    static constexpr uint64_t ReadBatch = 256;
+    static constexpr size_t MaxMessages = 64;
+
+    struct DirInfo {
+        std::vector<uint64_t> entries;
+    };
+
+public:
+    FsChecker(std::shared_ptr<IDisk> _disk, unsigned _threads = std::thread::hardware_concurrency())
+        : disk(_disk), threads(std::max(1u, _threads)) {}
+
+    FsckReport run() {
+        report = FsckReport{};
+        disk->read_block(0, reinterpret_cast<char *>(&sb));
+        if (!sb.valid()) {
+            error("超级块无效: magic 或 version 不匹配");
+            return report;
+        }
+        if (!sb.data.clean_shutdown)
+            error("文件系统未正常卸载, 日志尚未重放, 以下结果可能不准确");
+
+        load_metadata();
+        scan_inodes();
+        scan_snapshots();
+        check_refcounts();
+        check_fragment_table();
+        check_tree();
+        check_block_bitmap();
+        check_counters();
+        return report;
+    }
+
+private:
+    void error(std::string msg) {
+        std::lock_guard lock(report_mtx);
+        report.errors++;
+        if (report.messages.size() < MaxMessages)
+            report.messages.push_back(std::move(msg));
+        else if (report.messages.size() == MaxMessages)
+            report.messages.push_back("...");
+    }
+
+    void read_blocks(uint64_t lba, uint64_t cnt, uint8_t *buffer) {
+        std::lock_guard lock(io_mtx);
+        disk->read_blocks(lba, cnt, reinterpret_cast<char *>(buffer));
+    }
+
+    // 未初始化的元数据块按全 0 处理
+    std::vector<uint8_t> read_region(uint64_t start_lba, uint64_t cnt) {
+        std::vector<uint8_t> data(cnt * sb.data.block_size, 0);
+        for (uint64_t i = 0; i < cnt; i += ReadBatch)
+            read_blocks(start_lba + i, std::min(ReadBatch, cnt - i),
+                        data.data() + i * sb.data.block_size);
+        for (uint64_t i = 0; i < cnt; i++)
+            if (sb.block_uninit(start_lba + i))
+                std::fill_n(data.begin() + i * sb.data.block_size, sb.data.block_size, 0);
+        return data;
+    }
+
+    static bool test_bit(const std::vector<uint8_t> &bitmap, uint64_t idx) {
+        return bitmap[idx / 8] & (1 << (7 - idx % 8));
+    }
+
+    void load_metadata() {
+        block_bitmap = read_region(sb.data.bitmap_block_start_lba, sb.data.bitmap_blocks_cnt);
+        inode_bitmap =
+            read_region(sb.data.inode_valid_block_start_lba, sb.data.inode_valid_blocks_cnt);
+        auto map = read_region(sb.data.inode_chunk_map_start_lba, sb.data.inode_chunk_map_blocks_cnt);
+        chunk_lba.resize(sb.data.inode_chunks_cnt);
+        std::memcpy(chunk_lba.data(), map.data(), chunk_lba.size() * sizeof(uint64_t));
+
+        used = std::vector<std::atomic<uint64_t>>((sb.data.total_blocks + 63) / 64);
+        link_cnt.assign(sb.data.inodes_cnt, 0);
+        file_type.assign(sb.data.inodes_cnt, FileType::File);
+        refs = std::vector<std::atomic<uint32_t>>(sb.data.inodes_cnt);
+
+        for (uint64_t lba = 0; lba < sb.data.basic_blocks_cnt; lba++)
+            mark_block(lba, "保留区");
+        uint64_t mapped = 0;
+        for (uint64_t i = 0; i < chunk_lba.size(); i++) {
+            if (chunk_lba[i] == 0)
+                continue;
+            mapped++;
+            for (uint64_t j = 0; j < sb.data.inode_chunk_blocks; j++)
+                mark_block(chunk_lba[i] + j, std::format("INode 块组 {}", i));
+        }
+        if (mapped != sb.data.allocated_inode_chunks)
+            error(std::format("INode 块组数不一致: 映射表 {}, 超级块 {}", mapped,
+                              sb.data.allocated_inode_chunks));
+        if (sb.data.refcount_root)
+            load_refcounts(sb.data.refcount_root);
+        if (sb.data.fragment_root)
+            load_fragments(sb.data.fragment_root);
+    }
+
+    void load_refcounts(uint64_t lba) {
+        if (!mark_block(lba, "引用计数树节点"))
+            return;
+        auto node = std::make_unique<Node>();
+        read_blocks(lba, 1, reinterpret_cast<uint8_t *>(node.get()));
+        if (node->key_cnt >= Node::M) {
+            error(std::format("引用计数树节点 0x{:X} 键数 {} 非法", lba, node->key_cnt));
+            return;
+        }
+        if (node->is_leaf) {
+            for (uint64_t i = 0; i < node->key_cnt; i++)
+                extra_refs[node->keys[i]] = node->vals[i];
+        } else {
+            for (uint64_t i = 0; i <= node->key_cnt; i++)
+                load_refcounts(node->vals[i]);
+        }
+    }
+
+    // 碎片表中的碎片块由多个 INode 分用, 在此处标记一次
+    void load_fragments(uint64_t lba) {
+        if (!mark_block(lba, "碎片表节点"))
+            return;
+        auto node = std::make_unique<Node>();
+        read_blocks(lba, 1, reinterpret_cast<uint8_t *>(node.get()));
+        if (node->key_cnt >= Node::M) {
+            error(std::format("碎片表节点 0x{:X} 键数 {} 非法", lba, node->key_cnt));
+            return;
+        }
+        if (node->is_leaf) {
+            for (uint64_t i = 0; i < node->key_cnt; i++) {
+                const uint64_t mask = node->vals[i];
+                if (mask == 0 || mask >> FRAGMENTS_PER_BLOCK)
+                    error(std::format("碎片块 0x{:X} 的占用位图 0x{:X} 非法", node->keys[i], mask));
+                if (mark_block(node->keys[i], "碎片块"))
+                    fragment_masks[node->keys[i]] = mask;
+            }
+        } else {
+            for (uint64_t i = 0; i <= node->key_cnt; i++)
+                load_fragments(node->vals[i]);
+        }
+    }
+
+    // Fragment 存储的 INode 占用的碎片须在碎片表中登记, 且互不重叠
+    void check_fragment_run(uint64_t id, const INode &node) {
+        if (node.frag_cnt == 0 || node.frag_idx + node.frag_cnt > FRAGMENTS_PER_BLOCK) {
+            error(std::format("INode {} 的碎片区间 [{}, {}) 非法", id, node.frag_idx,
+                              node.frag_idx + node.frag_cnt));
+            return;
+        }
+        if (node.size > node.frag_cnt * FRAGMENT_SIZE)
+            error(std::format("INode {} 大小 {} 超过其 {} 个碎片", id, node.size, node.frag_cnt));
+        const uint64_t run = ((1ull << node.frag_cnt) - 1) << node.frag_idx;
+        std::lock_guard lock(fragment_mtx);
+        auto it = fragment_masks.find(node.block_lba);
+        if (it == fragment_masks.end()) {
+            error(std::format("INode {} 引用的碎片块 0x{:X} 不在碎片表中", id, node.block_lba));
+            return;
+        }
+        uint64_t &seen = fragment_seen[node.block_lba];
+        if (seen & run)
+            error(std::format("INode {} 的碎片与其它 INode 重叠, 碎片块 0x{:X}", id,
+                              node.block_lba));
+        seen |= run;
+    }
+
+    void check_fragment_table() {
+        for (auto [lba, mask] : fragment_masks) {
+            auto it = fragment_seen.find(lba);
+            const uint64_t seen = it == fragment_seen.end() ? 0 : it->second;
+            if (seen != mask)
+                error(std::format("碎片块 0x{:X} 占用位图为 0x{:X}, 实际被引用 0x{:X}", lba, mask,
+                                  seen));
+        }
+    }
+
+    // 被多个文件共享的盘块 (含共享索引树的根) 的实际引用数应为额外引用数加一
+    void check_refcounts() {
+        for (auto [lba, extra] : extra_refs) {
+            auto it = ref_seen.find(lba);
+            const uint64_t seen = it == ref_seen.end() ? 0 : it->second;
+            if (seen != extra + 1)
+                error(std::format("盘块 0x{:X} 引用计数为 {}, 实际被引用 {} 次", lba, extra + 1,
+                                  seen));
+        }
+    }
+
+    // 记录盘块被引用, 重复引用或越界时报错. 快照与当前文件系统可以共享盘块, 此时不检查重复
+    bool mark_block(uint64_t lba, const std::string &owner, bool shared = false) {
+        if (lba >= sb.data.total_blocks) {
+            error(std::format("{} 引用越界盘块 0x{:X}", owner, lba));
+            return false;
+        }
+        // 带引用计数的盘块只在第一次遇到时标记与遍历, 之后仅计数
+        if (!shared && extra_refs.count(lba)) {
+            std::lock_guard lock(ref_mtx);
+            if (++ref_seen[lba] > 1)
+                return false;
+        }
+        uint64_t bit = 1ull << (lba % 64);
+        if ((used[lba / 64].fetch_or(bit) & bit) && !shared) {
+            error(std::format("{} 引用的盘块 0x{:X} 已被其它对象占用", owner, lba));
+            return false;
+        }
+        return true;
+    }
+
+    void scan_inodes() {
+        std::atomic<uint64_t> next = 0;
+        auto worker = [&] {
+            std::vector<uint8_t> chunk(sb.data.inode_chunk_blocks * sb.data.block_size);
+            uint64_t checked = 0, referenced = 0;
+            for (uint64_t c = next++; c < chunk_lba.size(); c = next++) {
+                const uint64_t first_id = c * sb.data.inode_chunk_blocks * sb.data.inodes_per_block;
+                const uint64_t last_id = std::min(
+                    sb.data.inodes_cnt,
+                    first_id + sb.data.inode_chunk_blocks * sb.data.inodes_per_block);
+                if (chunk_lba[c] == 0) {
+                    for (uint64_t id = first_id; id < last_id; id++)
+                        if (test_bit(inode_bitmap, id))
+                            error(std::format("INode {} 已分配但所在块组未映射", id));
+                    continue;
+                }
+
+                read_blocks(chunk_lba[c], sb.data.inode_chunk_blocks, chunk.data());
+                for (uint64_t id = first_id; id < last_id; id++) {
+                    if (!test_bit(inode_bitmap, id))
+                        continue;
+                    INode node;
+                    std::memcpy(&node, chunk.data() + (id - first_id) * sb.data.inode_size,
+                                sizeof(INode));
+                    referenced += check_inode(id, node);
+                    checked++;
+                }
+            }
+            std::lock_guard lock(report_mtx);
+            report.inodes_checked += checked;
+            report.blocks_referenced += referenced;
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; i++)
+            workers.emplace_back(worker);
+        worker();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    // 返回该 INode 引用的盘块数 (含 B+ 树节点)
+    uint64_t check_inode(uint64_t id, const INode &node) {
+        if (node.ID != id)
+            error(std::format("INode {} 记录的 ID 为 {}", id, node.ID));
+        link_cnt[id] = node.link_cnt;
+        file_type[id] = node.file_type;
+
+        const std::string owner = std::format("INode {}", id);
+        std::vector<std::pair<uint64_t, uint64_t>> blocks;
+        uint64_t referenced = 0;
+        switch (node.storage_type) {
+        case StorageType::Inline:
+            if (node.size > sb.data.inode_inline_data_size)
+                error(std::format("INode {} 为 Inline 存储但大小为 {}", id, node.size));
+            break;
+        case StorageType::Direct:
+            referenced += mark_block(node.block_lba, owner);
+            blocks.emplace_back(0, node.block_lba);
+            break;
+        case StorageType::Index:
+            referenced += walk_tree(node.block_lba, owner, blocks);
+            if (node.init_size > node.size)
+                error(std::format("INode {} 已写入水位 {} 超过大小 {}", id, node.init_size,
+                                  node.size));
+            break;
+        case StorageType::Fragment:
+            if (node.file_type != FileType::File)
+                error(std::format("INode {} 不是普通文件但为 Fragment 存储", id));
+            check_fragment_run(id, node);
+            break;
+        default:
+            error(std::format("INode {} 存储类型非法", id));
+            return referenced;
+        }
+
+        if (node.file_type == FileType::Directory)
+            collect_dir(id, node, blocks);
+        return referenced;
+    }
+
+    // 遍历 B+ 树, 标记全部节点与数据块, 并输出 (文件块号, LBA)
+    uint64_t walk_tree(uint64_t lba, const std::string &owner,
+                       std::vector<std::pair<uint64_t, uint64_t>> &blocks, bool shared = false) {
+        if (!mark_block(lba, owner + " 的 B+ 树节点", shared))
+            return 0;
+        auto node = std::make_unique<Node>();
+        read_blocks(lba, 1, reinterpret_cast<uint8_t *>(node.get()));
+        if (node->key_cnt >= Node::M) {
+            error(std::format("{} 的 B+ 树节点 0x{:X} 键数 {} 非法", owner, lba, node->key_cnt));
+            return 1;
+        }
+        if (!std::is_sorted(node->keys, node->keys + node->key_cnt))
+            error(std::format("{} 的 B+ 树节点 0x{:X} 键无序", owner, lba));
+
+        uint64_t referenced = 1;
+        if (node->is_leaf) {
+            for (uint64_t i = 0; i < node->key_cnt; i++) {
+                referenced += mark_block(node->vals[i], owner, shared);
+                blocks.emplace_back(node->keys[i], node->vals[i]);
+            }
+        } else {
+            for (uint64_t i = 0; i <= node->key_cnt; i++)
+                referenced += walk_tree(node->vals[i], owner, blocks, shared);
+        }
+        return referenced;
+    }
+
+    void collect_dir(uint64_t id, const INode &node,
+                     const std::vector<std::pair<uint64_t, uint64_t>> &blocks) {
+        if (node.size % sizeof(DirItem))
+            error(std::format("目录 {} 大小 {} 不是目录项大小的整数倍", id, node.size));
+        const uint64_t item_cnt = node.size / sizeof(DirItem);
+        const uint64_t per_block = sb.data.block_size / sizeof(DirItem);
+
+        DirInfo info;
+        info.entries.reserve(item_cnt);
+        auto collect = [&](const uint8_t *data, uint64_t cnt) {
+            auto items = reinterpret_cast<const DirItem *>(data);
+            for (uint64_t i = 0; i < cnt; i++) {
+                if (items[i].inode_id >= sb.data.inodes_cnt) {
+                    error(std::format("目录 {} 中的目录项指向越界 INode {}", id,
+                                      items[i].inode_id));
+                    continue;
+                }
+                info.entries.push_back(items[i].inode_id);
+                // 指向自身的目录项 (".", 根目录的 "..") 不计入链接数
+                if (items[i].inode_id != id)
+                    refs[items[i].inode_id]++;
+            }
+        };
+
+        if (node.storage_type == StorageType::Inline) {
+            collect(reinterpret_cast<const uint8_t *>(node.inline_data),
+                    std::min<uint64_t>(item_cnt, sb.data.inode_inline_data_size / sizeof(DirItem)));
+        } else {
+            std::vector<uint8_t> data(sb.data.block_size);
+            for (auto [blk_idx, lba] : blocks) {
+                if (blk_idx * per_block >= item_cnt || lba >= sb.data.total_blocks)
+                    continue;
+                read_blocks(lba, 1, data.data());
+                collect(data.data(), std::min(per_block, item_cnt - blk_idx * per_block));
+            }
+        }
+
+        std::lock_guard lock(dir_mtx);
+        dirs[id] = std::move(info);
+    }
+
+    // 快照没有独立的位图, 从其根目录出发遍历可达的 INode, 标记其引用的盘块.
+    // 快照与当前文件系统共享的盘块不视为重复引用
+    void scan_snapshots() {
+        for (uint64_t i = 0; i < sb.data.snapshots_cnt && i < MAX_SNAPSHOTS; i++) {
+            const std::string owner = std::format("快照 {}", i);
+            const uint64_t lba = sb.data.snapshot_lbas[i];
+            if (!mark_block(lba, owner))
+                continue;
+            SuperBlock snap;
+            read_blocks(lba, 1, reinterpret_cast<uint8_t *>(&snap));
+            if (!snap.valid()) {
+                error(std::format("{} 的记录块 0x{:X} 无效", owner, lba));
+                continue;
+            }
+            for (uint64_t j = 0; j < snap.data.inode_chunk_map_blocks_cnt; j++)
+                mark_block(snap.data.inode_chunk_map_start_lba + j, owner + " 的映射表");
+            walk_snapshot(snap, owner);
+        }
+    }
+
+    void walk_snapshot(const SuperBlock &snap, const std::string &owner) {
+        std::vector<uint64_t> map(snap.data.inode_chunks_cnt);
+        std::vector<uint8_t> map_data(snap.data.inode_chunk_map_blocks_cnt * sb.data.block_size);
+        read_blocks(snap.data.inode_chunk_map_start_lba, snap.data.inode_chunk_map_blocks_cnt,
+                    map_data.data());
+        std::memcpy(map.data(), map_data.data(), map.size() * sizeof(uint64_t));
+        for (uint64_t lba : map)
+            for (uint64_t j = 0; lba && j < snap.data.inode_chunk_blocks; j++)
+                mark_block(lba + j, owner + " 的 INode 块组", true);
+
+        const uint64_t per_chunk = snap.data.inode_chunk_blocks * snap.data.inodes_per_block;
+        std::unordered_set<uint64_t> visited{snap.data.root_inode_id};
+        std::vector<uint64_t> stack{snap.data.root_inode_id};
+        std::vector<uint8_t> block(sb.data.block_size);
+        while (!stack.empty()) {
+            const uint64_t id = stack.back();
+            stack.pop_back();
+            if (id >= snap.data.inodes_cnt || map[id / per_chunk] == 0) {
+                error(std::format("{} 引用了未映射的 INode {}", owner, id));
+                continue;
+            }
+            read_blocks(map[id / per_chunk] + (id / snap.data.inodes_per_block) %
+                                                  snap.data.inode_chunk_blocks,
+                        1, block.data());
+            INode node;
+            std::memcpy(&node,
+                        block.data() + (id % snap.data.inodes_per_block) * sb.data.inode_size,
+                        sizeof(INode));
+
+            std::vector<std::pair<uint64_t, uint64_t>> blocks;
+            const std::string inode_owner = std::format("{} 的 INode {}", owner, id);
+            if (node.storage_type == StorageType::Direct) {
+                mark_block(node.block_lba, inode_owner, true);
+                blocks.emplace_back(0, node.block_lba);
+            } else if (node.storage_type == StorageType::Index) {
+                walk_tree(node.block_lba, inode_owner, blocks, true);
+            } else if (node.storage_type == StorageType::Fragment) {
+                mark_block(node.block_lba, inode_owner, true);
+            }
+            if (node.file_type != FileType::Directory)
+                continue;
+
+            const uint64_t item_cnt = node.size / sizeof(DirItem);
+            const uint64_t per_block = sb.data.block_size / sizeof(DirItem);
+            auto push = [&](const uint8_t *data, uint64_t cnt) {
+                auto items = reinterpret_cast<const DirItem *>(data);
+                for (uint64_t k = 0; k < cnt; k++)
+                    if (visited.insert(items[k].inode_id).second)
+                        stack.push_back(items[k].inode_id);
+            };
+            if (node.storage_type == StorageType::Inline) {
+                push(reinterpret_cast<const uint8_t *>(node.inline_data),
+                     std::min<uint64_t>(item_cnt,
+                                        sb.data.inode_inline_data_size / sizeof(DirItem)));
+                continue;
+            }
+            for (auto [blk_idx, lba] : blocks) {
+                if (blk_idx * per_block >= item_cnt || lba >= sb.data.total_blocks)
+                    continue;
+                read_blocks(lba, 1, block.data());
+                push(block.data(), std::min(per_block, item_cnt - blk_idx * per_block));
+            }
+        }
+    }
+
+    // 从根目录出发检查可达性与链接数
+    void check_tree() {
+        const uint64_t root = sb.data.root_inode_id;
+        std::vector<uint8_t> reachable(sb.data.inodes_cnt, 0);
+        std::vector<uint64_t> stack{root};
+        reachable[root] = 1;
+        while (!stack.empty()) {
+            uint64_t id = stack.back();
+            stack.pop_back();
+            auto it = dirs.find(id);
+            if (it == dirs.end()) {
+                error(std::format("目录 {} 未分配或无法读取", id));
+                continue;
+            }
+            for (uint64_t child : it->second.entries) {
+                if (reachable[child])
+                    continue;
+                reachable[child] = 1;
+                if (!test_bit(inode_bitmap, child)) {
+                    error(std::format("目录 {} 中的目录项指向未分配的 INode {}", id, child));
+                    continue;
+                }
+                if (file_type[child] == FileType::Directory)
+                    stack.push_back(child);
+            }
+        }
+
+        for (uint64_t id = 0; id < sb.data.inodes_cnt; id++) {
+            if (!test_bit(inode_bitmap, id))
+                continue;
+            if (!reachable[id])
+                error(std::format("INode {} 已分配但从根目录不可达", id));
+            else if (link_cnt[id] != refs[id])
+                error(std::format("INode {} 链接数为 {}, 实际被引用 {} 次", id, link_cnt[id],
+                                  refs[id].load()));
+        }
+    }
+
+    void check_block_bitmap() {
+        uint64_t leaked = 0, missing = 0;
+        for (uint64_t lba = 0; lba < sb.data.total_blocks; lba++) {
+            const bool in_bitmap = test_bit(block_bitmap, lba);
+            const bool referenced = used[lba / 64].load() & (1ull << (lba % 64));
+            if (in_bitmap && !referenced) {
+                if (leaked++ < 8)
+                    error(std::format("盘块 0x{:X} 已分配但未被引用", lba));
+            } else if (!in_bitmap && referenced) {
+                if (missing++ < 8)
+                    error(std::format("盘块 0x{:X} 被引用但位图中未分配", lba));
+            }
+        }
+        if (leaked > 8 || missing > 8)
+            error(std::format("位图不一致共计: 泄漏 {} 块, 缺失 {} 块", leaked, missing));
+    }
+
+    void check_counters() {
+        uint64_t used_blocks = 0;
+        for (uint64_t lba = 0; lba < sb.data.total_blocks; lba++)
+            used_blocks += test_bit(block_bitmap, lba);
+        if (sb.data.total_blocks - used_blocks != sb.data.free_blocks)
+            error(std::format("free_blocks 为 {}, 位图中空闲 {}", sb.data.free_blocks,
+                              sb.data.total_blocks - used_blocks));
+
+        uint64_t used_inodes = 0;
+        for (uint64_t id = 0; id < sb.data.inodes_cnt; id++)
+            used_inodes += test_bit(inode_bitmap, id);
+        if (sb.data.inodes_cnt - used_inodes != sb.data.free_inodes)
+            error(std::format("free_inodes 为 {}, 位图中空闲 {}", sb.data.free_inodes,
+                              sb.data.inodes_cnt - used_inodes));
+    }
+
+private:
+    std::shared_ptr<IDisk> disk;
+    const unsigned threads;
+    SuperBlock sb;
+    FsckReport report;
+
+    std::mutex io_mtx;
+    std::mutex report_mtx;
+    std::mutex dir_mtx;
+    std::mutex ref_mtx;
+    std::mutex fragment_mtx;
+
+    std::vector<uint8_t> block_bitmap;
+    std::vector<uint8_t> inode_bitmap;
+    std::vector<uint64_t> chunk_lba;
+
+    std::vector<std::atomic<uint64_t>> used;
+    std::vector<uint32_t> link_cnt;
+    std::vector<FileType> file_type;
+    std::vector<std::atomic<uint32_t>> refs;
+    std::unordered_map<uint64_t, DirInfo> dirs;
+    std::unordered_map<uint64_t, uint64_t> extra_refs;
+    std::unordered_map<uint64_t, uint64_t> ref_seen;
+    std::unordered_map<uint64_t, uint64_t> fragment_masks;
+    std::unordered_map<uint64_t, uint64_t> fragment_seen;
+};
@@ -11,6 +11,12 @@ public:
     virtual void write_block(uint64_t lba, const char *data) = 0;
     virtual void flush() = 0;
 
+    // 连续读取 cnt 个盘块, 实现可将其合并为一次大 I/O
+    virtual void read_blocks(uint64_t lba, uint64_t cnt, char *buffer) {
+        for (uint64_t i = 0; i < cnt; i++)
+            read_block(lba + i, buffer + i * block_size);
+    }
+
     void set_block_size(uint32_t _block_size) { block_size = _block_size; }
     uint32_t get_disk_size() { return disk_size_gb; }
 
@@ -12,6 +12,7 @@ enum class StorageType : uint8_t {
     Inline = 0,
     Direct = 1,
     Index = 2,
+    Fragment = 3,
 };
 
 struct INode {
@@ -21,7 +22,12 @@ struct INode {
     uint32_t link_cnt;
     FileType file_type;
     StorageType storage_type;
+    // Fragment 存储: 数据位于碎片块 block_lba 的 [frag_idx, frag_idx + frag_cnt) 号碎片
+    uint16_t frag_idx;
+    uint16_t frag_cnt;
     char inline_data[INODE_DATA_SIZE];
+    // Index 存储中 [0, init_size) 所在的块已写入过; 其后已映射的块为预分配的未写入块, 读出全零
+    uint64_t init_size;
     uint64_t size;
     INode(uint64_t _ID = 0, uint64_t _prev_inode_id = 0) {
         std::memset(this, 0, INODE_SIZE);
@@ -30,3 +36,17 @@ struct INode {
     }
 };
 static_assert(sizeof(INode) == INODE_SIZE);
+
+// 目录遍历与 stat 使用的精简属性, 避免整块复制 INode
+struct INodeAttr {
+    uint64_t ID = 0;
+    uint64_t size = 0;
+    uint32_t link_cnt = 0;
+    FileType file_type = FileType::File;
+    StorageType storage_type = StorageType::Inline;
+
+    INodeAttr() = default;
+    INodeAttr(uint64_t id, const INode &node)
+        : ID(id), size(node.size), link_cnt(node.link_cnt), file_type(node.file_type),
+          storage_type(node.storage_type) {}
+};
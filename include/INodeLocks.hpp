@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+// 按 INode 加的读写锁. 锁对象在首次加锁时创建, 最后一个持有者释放时回收, 锁表按 id 分片.
+// 加锁顺序: 父目录先于其中的目录项, 同时锁多个同级 INode 时按 id 升序
+template <size_t ShardCnt = 16>
+class INodeLocks {
+    struct Entry {
+        std::shared_mutex mtx;
+        size_t users = 0;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<uint64_t, std::unique_ptr<Entry>> entries;
+    };
+
+public:
+    // 持有期间 INode 处于加锁状态, 析构时解锁
+    class Guard {
+    public:
+        Guard() = default;
+        Guard(INodeLocks *_locks, uint64_t _id, bool _exclusive)
+            : locks(_locks), entry(_locks->acquire(_id)), id(_id), exclusive(_exclusive) {
+            if (exclusive)
+                entry->mtx.lock();
+            else
+                entry->mtx.lock_shared();
+        }
+        Guard(Guard &&other) noexcept { *this = std::move(other); }
+        Guard &operator=(Guard &&other) noexcept {
+            if (this != &other) {
+                release();
+                locks = std::exchange(other.locks, nullptr);
+                entry = std::exchange(other.entry, nullptr);
+                id = other.id;
+                exclusive = other.exclusive;
+            }
+            return *this;
+        }
+        ~Guard() { release(); }
+
+        void release() {
+            if (!locks)
+                return;
+            if (exclusive)
+                entry->mtx.unlock();
+            else
+                entry->mtx.unlock_shared();
+            locks->release(id);
+            locks = nullptr;
+        }
+
+    private:
+        INodeLocks *locks = nullptr;
+        Entry *entry = nullptr;
+        uint64_t id = 0;
+        bool exclusive = false;
+    };
+
+    Guard lock(uint64_t id) { return Guard(this, id, true); }
+    Guard lock_shared(uint64_t id) { return Guard(this, id, false); }
+
+private:
+    Entry *acquire(uint64_t id) {
+        auto &shard = shard_of(id);
+        std::lock_guard lock(shard.mtx);
+        auto &entry = shard.entries[id];
+        if (!entry)
+            entry = std::make_unique<Entry>();
+        entry->users++;
+        return entry.get();
+    }
+
+    void release(uint64_t id) {
+        auto &shard = shard_of(id);
+        std::lock_guard lock(shard.mtx);
+        auto it = shard.entries.find(id);
+        if (--it->second->users == 0)
+            shard.entries.erase(it);
+    }
+
+    Shard &shard_of(uint64_t id) { return shards[std::hash<uint64_t>{}(id) % ShardCnt]; }
+
+private:
+    std::array<Shard, ShardCnt> shards;
+};
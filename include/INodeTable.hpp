@@ -1,8 +1,17 @@
 #pragma once
 #include "BlockAllocator.hpp"
 #include "BlockIndexer.hpp"
+#include "FragmentAllocator.hpp"
 #include "INode.hpp"
 #include "IOContext.hpp"
+#include "ShardedLRUCache.hpp"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
 
 struct DirItem {
     uint64_t inode_id;
@@ -10,79 +19,429 @@ struct DirItem {
 };
 static_assert(sizeof(DirItem) == DIRITEM_SIZE);
 
-class INodeTable {
-    struct CacheItem {
-        uint64_t id;
+// 按块遍历文件数据 [offset, offset + len), 每步给出一个固定在缓存中的只读块视图,
+// 空洞以全零视图给出. Index 存储只下降一次 B+ 树, 之后沿叶子链成批取映射
+class INodeDataIterator {
+public:
+    INodeDataIterator(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IOContext> _ioc,
+                      std::shared_ptr<BlockIndexer> _blkidxer, const INode &node,
+                      uint64_t offset = 0, uint64_t len = UINT64_MAX)
+        : sb(_sb), iocontext(_ioc), blkidxer(_blkidxer), storage_type(node.storage_type),
+          root_lba(node.block_lba),
+          frag_base(node.storage_type == StorageType::Fragment ? node.frag_idx * FRAGMENT_SIZE : 0),
+          init_blk((node.init_size + sb->data.block_size - 1) / sb->data.block_size), pos(offset),
+          end_pos(std::min(node.size, offset + std::min(len, UINT64_MAX - offset))) {
+        if (storage_type == StorageType::Inline)
+            std::memcpy(inline_copy.data(), node.inline_data, INODE_DATA_SIZE);
+        load();
+    }
+
+    bool valid() const { return pos < end_pos; }
+    uint64_t offset() const { return pos; }
+
+    std::span<const uint8_t> block() const {
+        // 内联数据随迭代器一起移动, 不能缓存指向它的视图
+        if (storage_type == StorageType::Inline && valid())
+            return std::span<const uint8_t>(inline_copy.data() + pos, end_pos - pos);
+        return view;
+    }
+
+    void next() {
+        pos += block().size();
+        load();
+    }
+
+    // 当前块为空洞或预分配未写入的块时, 由映射的键间隔得出连续全零区间 [offset(), hole_end())
+    bool hole() const { return valid() && storage_type == StorageType::Index && !pin; }
+    uint64_t hole_end() const { return hole_to; }
+
+    // 越过当前整段全零区间, 停在下一个有数据的块或末尾
+    void skip_hole() {
+        pos = hole_to;
+        load();
+    }
+
+private:
+    void load() {
+        pin.reset();
+        if (!valid() || storage_type == StorageType::Inline) {
+            view = {};
+            return;
+        }
+
+        const uint64_t in_blk_offset = pos % sb->data.block_size;
+        const uint64_t len = std::min(sb->data.block_size - in_blk_offset, end_pos - pos);
+        // 预分配但未写入的块不查索引也不读盘
+        const uint64_t blk_idx = pos / sb->data.block_size;
+        const uint64_t lba = storage_type != StorageType::Index ? root_lba
+                             : blk_idx >= init_blk              ? 0
+                                                                : lookup(blk_idx);
+        if (lba == 0) {
+            // lookup 之后窗口停在 blk_idx 之后的第一个映射上, 水位线之后的映射也读出全零
+            hole_to = end_pos;
+            if (blk_idx < init_blk && window_idx < window.size() &&
+                window[window_idx].first < init_blk)
+                hole_to = std::min(end_pos, window[window_idx].first * sb->data.block_size);
+            static const std::array<uint8_t, BLOCK_SIZE> zero_block{};
+            view = std::span<const uint8_t>(zero_block.data() + in_blk_offset, len);
+            return;
+        }
+        pin = iocontext->read_block(lba);
+        view = std::span<const uint8_t>(pin->data() + frag_base + in_blk_offset, len);
+    }
+
+    uint64_t lookup(uint64_t blk_idx) {
+        while (window_idx < window.size() && window[window_idx].first < blk_idx)
+            window_idx++;
+        if (window_idx == window.size() && !scanned_to_end) {
+            const uint64_t last_blk_idx = (end_pos - 1) / sb->data.block_size;
+            const size_t want = std::min<uint64_t>(INDEX_SCAN_BATCH, last_blk_idx - blk_idx + 1);
+            window = blkidxer->scan_blocks(root_lba, blk_idx, want);
+            window_idx = 0;
+            scanned_to_end = window.size() < want;
+        }
+        if (window_idx < window.size() && window[window_idx].first == blk_idx)
+            return window[window_idx].second;
+        return 0;
+    }
+
+private:
+    std::shared_ptr<SuperBlock> sb;
+    std::shared_ptr<IOContext> iocontext;
+    std::shared_ptr<BlockIndexer> blkidxer;
+
+    StorageType storage_type;
+    uint64_t root_lba;
+    uint64_t frag_base;
+    uint64_t init_blk;
+    uint64_t pos;
+    uint64_t end_pos;
+    uint64_t hole_to = 0;
+    alignas(8) std::array<uint8_t, INODE_DATA_SIZE> inline_copy;
+
+    std::vector<std::pair<uint64_t, uint64_t>> window;
+    size_t window_idx = 0;
+    bool scanned_to_end = false;
+
+    std::shared_ptr<const Buffer> pin;
+    std::span<const uint8_t> view;
+};
+
+// 目录读取游标, 以目录块为批次给出目录项
+class DirCursor {
+public:
+    DirCursor(uint64_t _dir_id, INodeDataIterator _it) : id(_dir_id), it(std::move(_it)) {}
+
+    uint64_t dir_id() const { return id; }
+
+    // 返回当前目录块中的全部目录项, 视图在下一次调用前有效
+    std::span<const DirItem> next_batch() {
+        if (consumed)
+            it.next();
+        if (!it.valid())
+            return {};
+        consumed = true;
+        auto view = it.block();
+        return std::span<const DirItem>(reinterpret_cast<const DirItem *>(view.data()),
+                                        view.size() / sizeof(DirItem));
+    }
+
+    // 同 next_batch, 但目录项复制到游标内, 之后不再依赖目录块缓存.
+    // 供读取期间不持有目录锁的调用方使用
+    std::span<const DirItem> copy_batch() {
+        auto view = next_batch();
+        batch.assign(view.begin(), view.end());
+        return batch;
+    }
+
+    uint64_t offset() const { return consumed ? it.offset() + it.block().size() : it.offset(); }
+
+private:
+    uint64_t id;
+    INodeDataIterator it;
+    bool consumed = false;
+    std::vector<DirItem> batch;
+};
+
+// 按顺序消费一组只读缓冲区, 用于聚集写入
+class GatherCursor {
+public:
+    GatherCursor(std::span<const std::span<const uint8_t>> _iov) : iov(_iov) {
+        for (auto buf : iov)
+            left += buf.size();
+    }
+
+    size_t size() const { return left; }
+    bool empty() const { return left == 0; }
+
+    // 取出接下来的 n 字节复制到 dst
+    void copy_to(uint8_t *dst, size_t n) {
+        left -= n;
+        while (n > 0) {
+            const size_t k = std::min(n, iov[idx].size() - pos);
+            std::memcpy(dst, iov[idx].data() + pos, k);
+            dst += k;
+            n -= k;
+            pos += k;
+            if (pos == iov[idx].size()) {
+                idx++;
+                pos = 0;
+            }
+        }
+    }
+
+private:
+    std::span<const std::span<const uint8_t>> iov;
+    size_t left = 0;
+    size_t idx = 0;
+    size_t pos = 0;
+};
+
+class INodeCacheBackend : public ICacheBackend<uint64_t, INode> {
+public:
+    INodeCacheBackend(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IOContext> _ioc)
+        : sb(_sb), iocontext(_ioc) {}
+
+    INode load(uint64_t id) override {
         INode node;
-        bool dirty = false;
-    };
+        if (!chunk_lba(id))
+            return node;
+        std::shared_ptr<const Buffer> buffer = iocontext->read_block(inode_block_lba(id));
+        std::memcpy(&node, buffer->data() + (id % sb->data.inodes_per_block) * sb->data.inode_size,
+                    sb->data.inode_size);
+        return node;
+    }
+
+    void save(uint64_t id, const INode &node) override {
+        if (!chunk_lba(id)) {
+            spdlog::warn("[INodeManager] INode {} 所在块组未分配, 跳过回写", id);
+            return;
+        }
+        std::shared_ptr<Buffer> buffer = iocontext->acquire_block(inode_block_lba(id));
+        std::memcpy(buffer->data() + (id % sb->data.inodes_per_block) * sb->data.inode_size,
+                    &node, sb->data.inode_size);
+    }
+
+    // 同一 INode 块内的脏 INode 只获取一次盘块
+    void save_many(std::span<const std::pair<uint64_t, const INode *>> items) override {
+        std::shared_ptr<Buffer> buffer;
+        uint64_t buffer_lba = 0;
+        for (auto [id, node] : items) {
+            if (!chunk_lba(id)) {
+                spdlog::warn("[INodeManager] INode {} 所在块组未分配, 跳过回写", id);
+                continue;
+            }
+            if (!buffer || inode_block_lba(id) != buffer_lba) {
+                buffer_lba = inode_block_lba(id);
+                buffer = iocontext->acquire_block(buffer_lba);
+            }
+            std::memcpy(buffer->data() + (id % sb->data.inodes_per_block) * sb->data.inode_size,
+                        node, sb->data.inode_size);
+        }
+    }
+
+    uint64_t chunk_idx(uint64_t id) const {
+        return id / (sb->data.inodes_per_block * sb->data.inode_chunk_blocks);
+    }
+
+    // INode 块组映射表中 id 所在块组的起始 LBA, 0 表示尚未分配
+    uint64_t chunk_lba(uint64_t id) {
+        const uint64_t per_block = sb->data.block_size / sizeof(uint64_t);
+        const uint64_t idx = chunk_idx(id);
+        std::shared_ptr<const Buffer> buffer =
+            iocontext->read_block(idx / per_block + sb->data.inode_chunk_map_start_lba);
+        return entry(const_cast<uint8_t *>(buffer->data()), idx % per_block).load();
+    }
+
+    // 映射项可能在其它线程读取时被写时复制改写, 按项原子访问
+    void set_chunk_lba(uint64_t id, uint64_t lba) {
+        const uint64_t per_block = sb->data.block_size / sizeof(uint64_t);
+        const uint64_t idx = chunk_idx(id);
+        std::shared_ptr<Buffer> buffer =
+            iocontext->acquire_block(idx / per_block + sb->data.inode_chunk_map_start_lba);
+        entry(buffer->data(), idx % per_block).store(lba);
+    }
+
+private:
+    static std::atomic_ref<uint64_t> entry(uint8_t *block, uint64_t i) {
+        return std::atomic_ref<uint64_t>(reinterpret_cast<uint64_t *>(block)[i]);
+    }
 
+    uint64_t inode_block_lba(uint64_t id) {
+        return chunk_lba(id) + (id / sb->data.inodes_per_block) % sb->data.inode_chunk_blocks;
+    }
+
+private:
+    std::shared_ptr<SuperBlock> sb;
+    std::shared_ptr<IOContext> iocontext;
+};
+
+// 同一 INode 的并发读写由调用方以 INode 锁互斥 (见 FileSys), 本类只保护跨 INode 共享的状态
+class INodeTable {
 public:
     INodeTable(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IOContext> _ioc,
                std::shared_ptr<BlockAllocator> _blkalloc, std::shared_ptr<BlockIndexer> _blkidxer,
-               uint64_t _cache_size = 16384)
+               std::shared_ptr<FragmentAllocator> _fragalloc, uint64_t _cache_size = 16384)
         : sb(_sb), iocontext(_ioc), blkalloc(_blkalloc), blkidxer(_blkidxer),
-          max_cache_size(_cache_size) {}
+          fragalloc(_fragalloc) {
+        backend = std::make_shared<INodeCacheBackend>(sb, iocontext);
+        cache = std::make_unique<ShardedLRUCache<uint64_t, INode>>(_cache_size, backend);
+    }
 
     ~INodeTable() { flush(); }
 
     void reset_inode_bitmap() {
+        std::lock_guard lock(alloc_mtx);
         spdlog::debug("[INodeManager] 写入INode位图");
         std::shared_ptr<Buffer> buffer;
         for (uint64_t i = 0; i < sb->data.inode_valid_blocks_cnt; i++) {
+            if (sb->mark_block_uninit(i + sb->data.inode_valid_block_start_lba))
+                continue;
             buffer = iocontext->acquire_block(i + sb->data.inode_valid_block_start_lba);
             std::ranges::fill(*buffer, 0);
         }
+        for (uint64_t i = 0; i < sb->data.inode_chunk_map_blocks_cnt; i++) {
+            if (sb->mark_block_uninit(i + sb->data.inode_chunk_map_start_lba))
+                continue;
+            buffer = iocontext->acquire_block(i + sb->data.inode_chunk_map_start_lba);
+            std::ranges::fill(*buffer, 0);
+        }
+        sb->data.inode_alloc_hint = 0;
+        inode_free_cnt.clear();
+        for (uint64_t i = 0; i < sb->data.inode_valid_blocks_cnt; i++)
+            inode_free_cnt.push_back(valid_bits_in_bitmap_block(i));
         spdlog::debug("[INodeManager] INode位图写入完成");
     }
 
-    std::optional<uint64_t> allocate_inode(FileType type) {
-        spdlog::debug("[INodeManager] 查找空闲INode.");
-        bool find = false;
-        uint64_t bitmap_block_idx, byte_idx;
-        uint8_t bit_idx;
-
-        for (bitmap_block_idx = 0; bitmap_block_idx < sb->data.inode_valid_blocks_cnt;
-             bitmap_block_idx++) {
-            std::shared_ptr<const Buffer> cur_buffer =
-                iocontext->acquire_block(bitmap_block_idx + sb->data.inode_valid_block_start_lba);
-            for (byte_idx = 0; byte_idx < sb->data.block_size; byte_idx++) {
-                if ((*cur_buffer)[byte_idx] != 0xff) {
-                    find = true;
-                    for (bit_idx = 0; bit_idx < 8; bit_idx++) {
-                        if (~(*cur_buffer)[byte_idx] & (1 << (7 - bit_idx)))
-                            break;
-                    }
-                }
-                if (find)
-                    break;
-            }
-            if (find)
-                break;
+    // 给定父目录时优先就近放置: 文件落在父目录所在 INode 块附近, 目录则占用一个完全空闲的
+    // INode 块, 为其子项预留位置. 就近放置失败时退回从持久化游标开始的只读扫描
+    std::optional<uint64_t> allocate_inode(FileType type,
+                                           std::optional<uint64_t> parent_id = std::nullopt) {
+        std::lock_guard lock(alloc_mtx);
+        spdlog::debug("[INodeManager] 查找空闲INode. 从 {} 开始", sb->data.inode_alloc_hint);
+        load_inode_free_cnt();
+
+        const uint64_t hint = sb->data.inode_alloc_hint < sb->data.inodes_cnt
+                                  ? sb->data.inode_alloc_hint
+                                  : 0;
+        std::optional<uint64_t> id;
+        if (parent_id && type == FileType::Directory) {
+            id = find_free_group(hint, sb->data.inodes_cnt);
+            if (!id && hint > 0)
+                id = find_free_group(0, hint);
+        } else if (parent_id) {
+            const uint64_t goal = parent_id.value() / sb->data.inodes_per_block *
+                                  sb->data.inodes_per_block;
+            id = find_free_inode(goal, std::min(sb->data.inodes_cnt,
+                                                goal + sb->data.inodes_per_block *
+                                                           INODE_LOCALITY_BLOCKS));
         }
-        if (!find) {
+
+        if (!id) {
+            id = find_free_inode(hint, sb->data.inodes_cnt);
+            if (!id && hint > 0)
+                id = find_free_inode(0, hint);
+            if (id)
+                sb->data.inode_alloc_hint = id.value() + 1;
+        }
+        if (!id) {
             spdlog::warn("[INodeManager] 未找到空闲INode.");
             return std::nullopt;
         }
+        if ((!backend->chunk_lba(id.value()) && !allocate_chunk(id.value())) ||
+            !unshare_inode(id.value()))
+            return std::nullopt;
 
+        const uint64_t bitmap_block_idx = id.value() / sb->data.bits_per_block;
         std::shared_ptr<Buffer> buffer =
             iocontext->acquire_block(bitmap_block_idx + sb->data.inode_valid_block_start_lba);
-        (*buffer)[byte_idx] |= (1 << (7 - bit_idx));
-        uint64_t id = bitmap_block_idx * sb->data.bits_per_block + byte_idx * 8 + bit_idx;
-        spdlog::debug("[INodeManager] 找到空闲INode, id: {}", id);
+        (*buffer)[(id.value() % sb->data.bits_per_block) / 8] |= (1 << (7 - id.value() % 8));
+        spdlog::debug("[INodeManager] 找到空闲INode, id: {}", id.value());
 
         sb->data.free_inodes--;
+        inode_free_cnt[bitmap_block_idx]--;
 
-        auto it = get(id);
-        INode *node = &it->node;
+        // 新块组未清零, 槽位内容以分配时的初始化为准
+        auto node = get_mut(id.value());
+        *node = INode(id.value());
         node->file_type = type;
-        it->dirty = true;
 
         return id;
     }
 
+    // 批量分配 cnt 个 INode, 放置策略同 allocate_inode, 位图只扫描一遍.
+    // 空闲 INode 不足时返回的数量少于 cnt
+    std::vector<uint64_t> allocate_inodes(FileType type, uint64_t parent_id, size_t cnt) {
+        std::lock_guard lock(alloc_mtx);
+        spdlog::debug("[INodeManager] 批量查找 {} 个空闲INode.", cnt);
+        load_inode_free_cnt();
+
+        const uint64_t hint = sb->data.inode_alloc_hint < sb->data.inodes_cnt
+                                  ? sb->data.inode_alloc_hint
+                                  : 0;
+        const bool group = type == FileType::Directory;
+        std::vector<uint64_t> ids;
+        uint64_t local_from = 0, local_to = 0;
+        if (!group) {
+            local_from = parent_id / sb->data.inodes_per_block * sb->data.inodes_per_block;
+            local_to = std::min(sb->data.inodes_cnt,
+                                local_from + sb->data.inodes_per_block * INODE_LOCALITY_BLOCKS);
+            collect_free_inodes(local_from, local_to, false, cnt, ids);
+        }
+        const size_t local = ids.size();
+
+        // 就近窗口不够时退回从持久化游标开始扫描, 跳过已扫描过的窗口
+        auto collect = [&](uint64_t from, uint64_t to) {
+            if (from < local_from)
+                collect_free_inodes(from, std::min(to, local_from), group, cnt, ids);
+            if (to > local_to)
+                collect_free_inodes(std::max(from, local_to), to, group, cnt, ids);
+        };
+        collect(hint, sb->data.inodes_cnt);
+        if (ids.size() < cnt && hint > 0)
+            collect(0, hint);
+
+        // 块组分配或复制失败时只保留其之前的 INode
+        for (size_t i = 0; i < ids.size(); i++) {
+            if ((!backend->chunk_lba(ids[i]) && !allocate_chunk(ids[i])) ||
+                !unshare_inode(ids[i])) {
+                ids.resize(i);
+                break;
+            }
+        }
+        if (ids.size() < cnt)
+            spdlog::warn("[INodeManager] 空闲INode不足, 只分配到 {}/{} 个.", ids.size(), cnt);
+        if (ids.empty())
+            return ids;
+        if (ids.size() > local)
+            sb->data.inode_alloc_hint = ids.back() + 1;
+
+        // 相邻的 ids 多在同一位图块中, 连续命中时只取一次
+        std::shared_ptr<Buffer> buffer;
+        uint64_t buffer_blk = UINT64_MAX;
+        for (uint64_t id : ids) {
+            const uint64_t bitmap_block_idx = id / sb->data.bits_per_block;
+            if (bitmap_block_idx != buffer_blk) {
+                buffer_blk = bitmap_block_idx;
+                buffer = iocontext->acquire_block(bitmap_block_idx +
+                                                  sb->data.inode_valid_block_start_lba);
+            }
+            (*buffer)[(id % sb->data.bits_per_block) / 8] |= (1 << (7 - id % 8));
+            inode_free_cnt[bitmap_block_idx]--;
+
+            auto node = get_mut(id);
+            *node = INode(id);
+            node->file_type = type;
+        }
+        sb->data.free_inodes -= ids.size();
+        return ids;
+    }
+
+    // 调用方须先确认 INode 所在块组可写 (见 unshare_inode), 否则不做任何修改
     void free_inode(uint64_t id) {
-        INode *node = &get(id)->node;
+        auto node = get_mut(id);
+        if (!node)
+            return;
 
         uint64_t lba = id / sb->data.bits_per_block + sb->data.inode_valid_block_start_lba;
         uint64_t byte_idx = (id % sb->data.bits_per_block) / 8;
@@ -92,156 +451,440 @@ public:
             blkalloc->free_block(node->block_lba);
         } else if (node->storage_type == StorageType::Index) {
             blkidxer->free_node(node->block_lba);
+        } else if (node->storage_type == StorageType::Fragment) {
+            fragalloc->free(node->block_lba, node->frag_idx, node->frag_cnt);
         }
 
-        std::memset(&get(id)->node, 0, sb->data.inode_size);
-        get(id)->dirty = true;
+        std::memset(static_cast<void *>(node.get()), 0, sb->data.inode_size);
+        {
+            std::lock_guard lock(dirty_mtx);
+            dirty_blocks.erase(id);
+        }
 
+        std::lock_guard lock(alloc_mtx);
         std::shared_ptr<Buffer> buffer = iocontext->acquire_block(lba);
         (*buffer)[byte_idx] &= ~((uint8_t)1 << (7 - bit_idx));
 
         sb->data.free_inodes++;
+        sb->data.inode_alloc_hint = std::min(sb->data.inode_alloc_hint, id);
+        if (!inode_free_cnt.empty())
+            inode_free_cnt[id / sb->data.bits_per_block]++;
     }
 
     size_t read_data(uint64_t id, uint64_t offset, std::span<uint8_t> data) {
-        spdlog::debug("[INodeTable] 读取数据, id: {}.", id);
-        INode *node = &get(id)->node;
-
-        const uint64_t size = std::min(data.size(), node->size - offset);
+        return read_data(id, offset, std::span<const std::span<uint8_t>>(&data, 1));
+    }
 
-        if (node->storage_type == StorageType::Inline) {
-            std::memcpy(data.data(), node->inline_data + offset, size);
-        } else if (node->storage_type == StorageType::Direct) {
-            std::shared_ptr<const Buffer> data_block_buffer =
-                iocontext->read_block(node->block_lba);
-            std::memcpy(data.data(), data_block_buffer->data() + offset, size);
-        } else if (node->storage_type == StorageType::Index) {
-            uint64_t in_block_offset = offset % sb->data.block_size;
-            uint64_t write_pos = 0;
-            uint64_t cur_epoch_size;
-            uint64_t cur_lba;
-            uint64_t remain_size = size;
-
-            std::shared_ptr<const Buffer> data_block_buffer;
-            for (uint64_t i = offset / sb->data.block_size;
-                 i <= (offset + size - 1) / sb->data.block_size; i++) {
-                cur_lba = blkidxer->find_block(node->block_lba, i).value_or(0);
-                cur_epoch_size = std::min(remain_size, sb->data.block_size - in_block_offset);
-                if (cur_lba != 0) {
-                    data_block_buffer = iocontext->read_block(cur_lba);
-                    std::memcpy(data.data() + write_pos,
-                                data_block_buffer->data() + in_block_offset, cur_epoch_size);
+    // 分散读取: 文件中从 offset 起的连续区间依次填入 iov, 整个区间只遍历一次
+    size_t read_data(uint64_t id, uint64_t offset, std::span<const std::span<uint8_t>> iov) {
+        spdlog::debug("[INodeTable] 读取数据, id: {}.", id);
+        uint64_t total = 0;
+        for (auto buf : iov)
+            total += buf.size();
+        size_t size = 0, idx = 0, pos = 0;
+        // src 为空时填零
+        auto scatter = [&](const uint8_t *src, size_t len) {
+            size += len;
+            while (len > 0) {
+                const size_t n = std::min(len, iov[idx].size() - pos);
+                if (src) {
+                    std::memcpy(iov[idx].data() + pos, src, n);
+                    src += n;
                 } else {
-                    std::memset(data.data() + write_pos, 0, cur_epoch_size);
+                    std::memset(iov[idx].data() + pos, 0, n);
+                }
+                len -= n;
+                pos += n;
+                if (pos == iov[idx].size()) {
+                    idx++;
+                    pos = 0;
                 }
-                in_block_offset = 0;
-                write_pos += cur_epoch_size;
-                remain_size -= cur_epoch_size;
+            }
+        };
+        // 连续的空洞整段清零, 不逐块前进
+        for (auto it = data_iter(id, offset, total); it.valid();) {
+            if (it.hole()) {
+                scatter(nullptr, it.hole_end() - it.offset());
+                it.skip_hole();
+            } else {
+                scatter(it.block().data(), it.block().size());
+                it.next();
             }
         }
         return size;
     }
 
-    bool write_data(uint64_t id, uint64_t offset, std::span<uint8_t> data) {
+    bool write_data(uint64_t id, uint64_t offset, std::span<const uint8_t> data) {
+        return write_data(id, offset, std::span<const std::span<const uint8_t>>(&data, 1));
+    }
+
+    // 聚集写入: iov 依次写入文件中从 offset 起的连续区间, INode 只取一次.
+    // Index 存储一次扫描取出区间内已有的全部映射, 之后逐块写入, 不再逐块查找 B+ 树
+    bool write_data(uint64_t id, uint64_t offset, std::span<const std::span<const uint8_t>> iov) {
         spdlog::debug("[INodeTable] 写入数据, id: {}.", id);
+        GatherCursor data(iov);
         if (data.empty())
             return true;
 
-        auto it = get(id);
-        INode *node = &it->node;
-        it->dirty = true;
+        auto node = get_mut(id);
+        if (!node)
+            return false;
 
         if (node->storage_type == StorageType::Inline) {
             if (offset + data.size() <= sb->data.inode_inline_data_size) {
-                std::memcpy(node->inline_data + offset, data.data(), data.size());
-                node->size = std::max(node->size, offset + data.size());
-                write_inode_to_disk(id, node);
+                const uint64_t end = offset + data.size();
+                data.copy_to(reinterpret_cast<uint8_t *>(node->inline_data) + offset, data.size());
+                node->size = std::max(node->size, end);
                 return true;
             }
-            // 数据超出 Inline 范围
-            auto data_block_lba = blkalloc->allocate_block();
-            if (!data_block_lba) {
+            // 数据超出 Inline 范围. 空文件首次写在首块之后时直接转为 Index, 之前留作空洞
+            if (node->size == 0 && offset >= sb->data.block_size) {
+                if (!empty_to_index(node.get(), offset / sb->data.block_size))
+                    return false;
+            } else if (!grow_small(node.get(), offset + data.size())) {
                 return false;
             }
-            std::shared_ptr<Buffer> data_buffer = iocontext->acquire_block(data_block_lba.value());
-            std::memcpy(data_buffer->data(), node->inline_data, node->size);
-            std::memset(node->inline_data, 0, node->size);
-            if (offset <= sb->data.block_size) {
-                const uint64_t cur_block_new_data_size =
-                    std::min(data.size() + offset, (size_t)sb->data.block_size) - offset;
-                std::memcpy(data_buffer->data() + offset, data.data(), cur_block_new_data_size);
-                node->size = std::max(node->size, offset + cur_block_new_data_size);
-                offset += cur_block_new_data_size;
-                data = data.subspan(cur_block_new_data_size);
-            }
-            node->block_lba = data_block_lba.value();
-            node->storage_type = StorageType::Direct;
-            if (data.empty()) {
-                write_inode_to_disk(id, node);
+        }
+        if (node->storage_type == StorageType::Fragment) {
+            const uint64_t end = offset + data.size();
+            if (end <= FRAGMENT_MAX_SIZE) {
+                if (!reserve_fragments(node.get(), fragments_for(std::max(node->size, end))))
+                    return false;
+                std::shared_ptr<Buffer> buffer = acquire_fragments(node.get());
+                data.copy_to(buffer->data() + node->frag_idx * FRAGMENT_SIZE + offset,
+                             data.size());
+                node->size = std::max(node->size, end);
                 return true;
             }
+            if (!to_direct(node.get()))
+                return false;
         }
         if (node->storage_type == StorageType::Direct) {
             if (data.size() + offset <= sb->data.block_size) {
-                std::shared_ptr<Buffer> data_buffer = iocontext->acquire_block(node->block_lba);
-                std::memcpy(data_buffer->data() + offset, data.data(), data.size());
-                node->size = std::max(node->size, offset + data.size());
-                write_inode_to_disk(id, node);
+                std::shared_ptr<Buffer> data_buffer =
+                    acquire_content_block(node.get(), 0, node->block_lba);
+                if (!data_buffer)
+                    return false;
+                const uint64_t end = offset + data.size();
+                data.copy_to(data_buffer->data() + offset, data.size());
+                node->size = std::max(node->size, end);
                 return true;
             }
             // 数据超出 Direct 范围
             if (offset <= sb->data.block_size) {
                 const uint64_t cur_block_new_data_size =
                     std::min(data.size() + offset, (size_t)sb->data.block_size) - offset;
-                std::shared_ptr<Buffer> data_buffer = iocontext->acquire_block(node->block_lba);
-                std::memcpy(data_buffer->data() + offset, data.data(), cur_block_new_data_size);
+                std::shared_ptr<Buffer> data_buffer =
+                    acquire_content_block(node.get(), 0, node->block_lba);
+                if (!data_buffer)
+                    return false;
+                data.copy_to(data_buffer->data() + offset, cur_block_new_data_size);
                 node->size = std::max(node->size, offset + cur_block_new_data_size);
                 offset += cur_block_new_data_size;
-                data = data.subspan(cur_block_new_data_size);
             }
-            auto optlba = blkidxer->insert_block(0, 0, node->block_lba);
-            if (!optlba)
+            if (!direct_to_index(node.get()))
                 return false;
-            node->block_lba = optlba.value();
-            node->storage_type = StorageType::Index;
         }
         if (node->storage_type == StorageType::Index) {
             auto cur_pos = offset;
             const auto end_pos = offset + data.size();
+            const uint64_t first_blk = offset / sb->data.block_size;
+            // 跳过的预分配块先清零, 区间内未写入的块按新块处理
+            if (!zero_unwritten(node.get(), first_blk))
+                return false;
+            const uint64_t init_blk =
+                (node->init_size + sb->data.block_size - 1) / sb->data.block_size;
+            const auto mapped = blkidxer->scan_blocks(
+                node->block_lba, first_blk, (end_pos - 1) / sb->data.block_size - first_blk + 1);
+            size_t next_mapped = 0;
             while (!data.empty()) {
                 uint64_t cur_blk_idx = cur_pos / sb->data.block_size;
                 uint64_t in_blk_offset = cur_pos % sb->data.block_size;
                 uint64_t batch_size =
                     std::min(data.size(), (size_t)sb->data.block_size - in_blk_offset);
 
-                uint64_t blk_lba = blkidxer->find_block(node->block_lba, cur_blk_idx).value_or(0);
+                while (next_mapped < mapped.size() && mapped[next_mapped].first < cur_blk_idx)
+                    next_mapped++;
+                uint64_t blk_lba = next_mapped < mapped.size() &&
+                                           mapped[next_mapped].first == cur_blk_idx
+                                       ? mapped[next_mapped].second
+                                       : 0;
+                const bool fresh = blk_lba == 0 || cur_blk_idx >= init_blk;
 
                 if (blk_lba == 0) {
+                    if (!unshare_path(node.get(), cur_blk_idx))
+                        return false;
                     auto new_blk_lba = blkalloc->allocate_block();
                     if (!new_blk_lba)
                         return false;
                     auto optlba =
                         blkidxer->insert_block(node->block_lba, cur_blk_idx, new_blk_lba.value());
-                    if (!optlba)
+                    if (!optlba) {
+                        blkalloc->free_block(new_blk_lba.value());
                         return false;
+                    }
                     node->block_lba = optlba.value();
                     blk_lba = new_blk_lba.value();
                 }
-                std::shared_ptr<Buffer> blk_buffer = iocontext->acquire_block(blk_lba);
-                std::memcpy(blk_buffer->data() + in_blk_offset, data.data(), batch_size);
+                std::shared_ptr<Buffer> blk_buffer =
+                    acquire_content_block(node.get(), cur_blk_idx, blk_lba);
+                if (!blk_buffer)
+                    return false;
+                if (fresh && batch_size < sb->data.block_size)
+                    std::ranges::fill(*blk_buffer, 0);
+                data.copy_to(blk_buffer->data() + in_blk_offset, batch_size);
 
-                data = data.subspan(batch_size);
                 cur_pos += batch_size;
             }
             node->size = std::max(end_pos, node->size);
+            node->init_size = std::max(end_pos, node->init_size);
+        }
+        return true;
+    }
+
+    // 为 [offset, offset + len) 中尚未映射的块按连续段预留盘块, 文件大小随之扩展.
+    // 预留的块记为未写入, 读出全零且不访问硬盘, 之后的写入直接使用而无需再分配与插入索引
+    bool allocate_range(uint64_t id, uint64_t offset, uint64_t len) {
+        spdlog::debug("[INodeTable] 预分配, id: {}, offset: {}, len: {}.", id, offset, len);
+        if (len == 0)
+            return true;
+        auto node = get_mut(id);
+        if (!node)
+            return false;
+        if ((node->storage_type == StorageType::Inline ||
+             node->storage_type == StorageType::Fragment) &&
+            !to_direct(node.get()))
+            return false;
+        if (node->storage_type == StorageType::Direct && !direct_to_index(node.get()))
+            return false;
+
+        const uint64_t first_blk = offset / sb->data.block_size;
+        const uint64_t last_blk = (offset + len - 1) / sb->data.block_size;
+        const auto mapped =
+            blkidxer->scan_blocks(node->block_lba, first_blk, last_blk - first_blk + 1);
+        std::vector<uint64_t> holes;
+        size_t next_mapped = 0;
+        for (uint64_t idx = first_blk; idx <= last_blk; idx++) {
+            while (next_mapped < mapped.size() && mapped[next_mapped].first < idx)
+                next_mapped++;
+            if (next_mapped == mapped.size() || mapped[next_mapped].first != idx)
+                holes.push_back(idx);
+        }
+
+        const uint64_t init_blk =
+            (node->init_size + sb->data.block_size - 1) / sb->data.block_size;
+        uint64_t run_lba = 0, run_left = 0;
+        size_t inserted = 0;
+        bool ok = true;
+        for (; inserted < holes.size(); inserted++) {
+            const uint64_t idx = holes[inserted];
+            if (run_left == 0) {
+                auto run = blkalloc->allocate_run(holes.size() - inserted);
+                if (!run) {
+                    ok = false;
+                    break;
+                }
+                run_lba = run->first;
+                run_left = run->second;
+            }
+            const uint64_t lba = run_lba++;
+            run_left--;
+            std::optional<uint64_t> root;
+            if (unshare_path(node.get(), idx))
+                root = blkidxer->insert_block(node->block_lba, idx, lba);
+            if (!root) {
+                blkalloc->free_block(lba);
+                ok = false;
+                break;
+            }
+            node->block_lba = root.value();
+            // 已写入区间内的空洞读出须为零, 不能记为未写入
+            if (idx < init_blk) {
+                auto buffer = acquire_content_block(node.get(), idx, lba);
+                if (!buffer) {
+                    inserted++;
+                    ok = false;
+                    break;
+                }
+                std::ranges::fill(*buffer, 0);
+            }
+        }
+        if (!ok) {
+            // 归还连续段中未用的盘块并撤销已插入的块, 文件保持预分配前的样子
+            while (run_left--)
+                blkalloc->free_block(run_lba++);
+            for (size_t i = 0; i < inserted; i++)
+                release_blocks(node.get(), holes[i], holes[i] + 1);
+            return false;
+        }
+        node->size = std::max(node->size, offset + len);
+        return true;
+    }
+
+    // 把文件大小改为 new_size. 缩短时释放新大小之外的数据块与索引节点, 数据可放入单块,
+    // 碎片或 INode 内联区时降级为相应的存储; 延长的部分为空洞, 读出全零
+    bool truncate(uint64_t id, uint64_t new_size) {
+        spdlog::debug("[INodeTable] 截断, id: {}, size: {}.", id, new_size);
+        auto node = get_mut(id);
+        if (!node)
+            return false;
+        const uint64_t block_size = sb->data.block_size;
+        if (new_size >= node->size) {
+            if (node->storage_type == StorageType::Inline &&
+                new_size > sb->data.inode_inline_data_size && !grow_small(node.get(), new_size))
+                return false;
+            if (node->storage_type == StorageType::Fragment && !grow_small(node.get(), new_size))
+                return false;
+            if (node->storage_type == StorageType::Direct && new_size > block_size &&
+                !direct_to_index(node.get()))
+                return false;
+            node->size = new_size;
+            return true;
+        }
+
+        const uint64_t keep = (new_size + block_size - 1) / block_size;
+        if (node->storage_type == StorageType::Index &&
+            !release_blocks(node.get(), keep, UINT64_MAX))
+            return false;
+        // 保留部分之后的字节须为零, 之后延长或写入越过它们时才能读出全零
+        if ((node->storage_type == StorageType::Inline || new_size % block_size) &&
+            !zero_bytes(node.get(), new_size, std::min(node->size, keep * block_size)))
+            return false;
+        node->size = new_size;
+        node->init_size = std::min(node->init_size, new_size);
+
+        if (node->storage_type == StorageType::Index && new_size <= block_size &&
+            !index_to_direct(node.get()))
+            return false;
+        if (node->storage_type != StorageType::Inline &&
+            new_size <= sb->data.inode_inline_data_size) {
+            to_inline(node.get());
+        } else if (node->storage_type == StorageType::Direct &&
+                   node->file_type == FileType::File && new_size <= FRAGMENT_MAX_SIZE) {
+            return to_fragments(node.get(), fragments_for(new_size));
+        } else if (node->storage_type == StorageType::Fragment &&
+                   fragments_for(new_size) < node->frag_cnt) {
+            const uint64_t keep_frags = fragments_for(new_size);
+            fragalloc->free(node->block_lba, node->frag_idx + keep_frags,
+                            node->frag_cnt - keep_frags);
+            node->frag_cnt = keep_frags;
+        }
+        return true;
+    }
+
+    // 释放 [offset, offset + len) 完全覆盖的块 (Index 存储), 其余部分清零. 文件大小不变
+    bool punch_hole(uint64_t id, uint64_t offset, uint64_t len) {
+        spdlog::debug("[INodeTable] 打洞, id: {}, offset: {}, len: {}.", id, offset, len);
+        auto node = get_mut(id);
+        if (!node)
+            return false;
+        if (offset >= node->size)
+            return true;
+        const uint64_t end = offset + std::min(len, node->size - offset);
+        const uint64_t block_size = sb->data.block_size;
+        const uint64_t first_full = (offset + block_size - 1) / block_size;
+        // 区间延伸到文件末尾时, 最后一个不足一块的块也可整块释放
+        const uint64_t end_full =
+            end == node->size ? (end + block_size - 1) / block_size : end / block_size;
+
+        if (node->storage_type == StorageType::Index && first_full < end_full)
+            return zero_bytes(node.get(), offset, first_full * block_size) &&
+                   zero_bytes(node.get(), end_full * block_size, end) &&
+                   release_blocks(node.get(), first_full, end_full);
+        for (uint64_t pos = offset; pos < end;) {
+            const uint64_t next = std::min(end, (pos / block_size + 1) * block_size);
+            if (!zero_bytes(node.get(), pos, next))
+                return false;
+            pos = next;
         }
         return true;
     }
 
+    // 从 offset 起第一个数据块的起点 (不早于 offset). 空洞与预分配未写入的块不算数据,
+    // 其后再无数据或 offset 不小于文件大小时返回 nullopt
+    std::optional<uint64_t> seek_data(uint64_t id, uint64_t offset) {
+        const INode node = *get(id);
+        if (offset >= node.size)
+            return std::nullopt;
+        if (node.storage_type != StorageType::Index)
+            return offset;
+        const uint64_t blk_idx = offset / sb->data.block_size;
+        const uint64_t init_blk = (node.init_size + sb->data.block_size - 1) / sb->data.block_size;
+        auto next = blkidxer->scan_blocks(node.block_lba, blk_idx, 1);
+        if (next.empty() || next[0].first >= init_blk)
+            return std::nullopt;
+        return std::max(offset, next[0].first * sb->data.block_size);
+    }
+
+    // 从 offset 起第一个空洞的起点 (不早于 offset), 文件末尾视为空洞.
+    // 按批扫描索引比较相邻的键, 不读数据块; offset 不小于文件大小时返回 nullopt
+    std::optional<uint64_t> seek_hole(uint64_t id, uint64_t offset) {
+        const INode node = *get(id);
+        if (offset >= node.size)
+            return std::nullopt;
+        if (node.storage_type != StorageType::Index)
+            return node.size;
+        const uint64_t init_blk = (node.init_size + sb->data.block_size - 1) / sb->data.block_size;
+        uint64_t expect = offset / sb->data.block_size;
+        while (expect < init_blk) {
+            auto batch = blkidxer->scan_blocks(node.block_lba, expect, INDEX_SCAN_BATCH);
+            for (auto it = batch.begin(); it != batch.end() && it->first == expect; ++it)
+                expect++;
+            if (batch.size() < INDEX_SCAN_BATCH || expect <= batch.back().first)
+                break;
+        }
+        expect = std::min(expect, init_blk);
+        return std::min(node.size, std::max(offset, expect * sb->data.block_size));
+    }
+
+    // 在 INode 之间复制 [off_in, off_in + len), 返回复制的字节数. 两侧对齐的整块只共享盘块并
+    // 增加引用计数, 其余部分从源缓存块直接写入目标, 不经过调用方缓冲区. 源文件的空洞不分配
+    // 盘块, 目标对应区间打洞并按需延长
+    size_t copy_range(uint64_t src_id, uint64_t off_in, uint64_t dst_id, uint64_t off_out,
+                      uint64_t len) {
+        spdlog::debug("[INodeTable] 复制数据, {}:{} -> {}:{}, len: {}.", src_id, off_in, dst_id,
+                      off_out, len);
+        const uint64_t src_size = get(src_id)->size;
+        if (off_in >= src_size)
+            return 0;
+        len = std::min(len, src_size - off_in);
+        if (src_id == dst_id && off_in < off_out + len && off_out < off_in + len) {
+            spdlog::warn("[INodeTable] 同一文件内的复制区间重叠, 拒绝复制.");
+            return 0;
+        }
+
+        const uint64_t block_size = sb->data.block_size;
+        size_t copied = 0;
+        while (copied < len) {
+            const uint64_t in = off_in + copied, out = off_out + copied;
+            if (auto data_at = seek_data(src_id, in); !data_at || data_at.value() > in) {
+                const uint64_t n = std::min(off_in + len, data_at.value_or(UINT64_MAX)) - in;
+                if (!punch_hole(dst_id, out, n) ||
+                    (get(dst_id)->size < out + n && !truncate(dst_id, out + n)))
+                    break;
+                copied += n;
+                continue;
+            }
+            if (in % block_size == 0 && out % block_size == 0 && len - copied >= block_size &&
+                share_block(src_id, in / block_size, dst_id, out / block_size)) {
+                copied += block_size;
+                continue;
+            }
+
+            const uint64_t n = std::min({block_size - in % block_size,
+                                         block_size - out % block_size, len - copied});
+            auto it = data_iter(src_id, in, n);
+            if (!write_data(dst_id, out, it.block()))
+                break;
+            copied += n;
+        }
+        return copied;
+    }
+
     bool add_diritem(uint64_t id, std::string name, uint64_t to) {
         spdlog::debug("[INodeTable] 添加目录项, id: {}, name: {}, to id: {}.", id, name, to);
 
-        INode *node = &get(id)->node;
+        auto node = get(id);
         if (node->file_type != FileType::Directory)
             return false;
 
@@ -255,10 +898,38 @@ public:
         if (find_inode_by_name(id, new_item->name).has_value())
             return false;
 
-        write_data(id, node->size, new_item_buffer);
-        get(id)->dirty = true;
+        if ((id != to && !unshare_inode(to)) || !write_data(id, node->size, new_item_buffer))
+            return false;
         if (id != to)
-            get(to)->node.link_cnt++;
+            get_mut(to)->link_cnt++;
+        return true;
+    }
+
+    // 一次写入追加多个目录项, 调用方保证名字互不相同且目录中不存在
+    bool add_diritems(uint64_t id, std::span<const std::pair<std::string, uint64_t>> items) {
+        spdlog::debug("[INodeTable] 批量添加目录项, id: {}, 数量: {}.", id, items.size());
+
+        auto node = get(id);
+        if (node->file_type != FileType::Directory)
+            return false;
+
+        std::vector<uint8_t> buffer(items.size() * sb->data.diritem_size, 0);
+        for (size_t i = 0; i < items.size(); i++) {
+            auto &[name, to] = items[i];
+            DirItem *item = reinterpret_cast<DirItem *>(buffer.data() + i * sb->data.diritem_size);
+            uint16_t name_size = std::min((size_t)sb->data.filename_size - 1, name.size());
+            std::memcpy(item->name, name.data(), name_size);
+            item->inode_id = to;
+        }
+
+        for (auto &[name, to] : items)
+            if (id != to && !unshare_inode(to))
+                return false;
+        if (!write_data(id, node->size, buffer))
+            return false;
+        for (auto &[name, to] : items)
+            if (id != to)
+                get_mut(to)->link_cnt++;
         return true;
     }
 
@@ -266,121 +937,803 @@ public:
     bool remove_diritem(uint64_t id, std::string name) {
         if (name == "." || name == "..")
             return false;
-        INode *node = &get(id)->node;
-        std::vector<uint8_t> buffer(sb->data.diritem_size);
-        for (uint64_t i = 0; i < node->size; i += sb->data.diritem_size) {
-            read_data(id, i, buffer);
-            DirItem *item = reinterpret_cast<DirItem *>(buffer.data());
-            if (item->name != name)
-                continue;
-            INode *item_node = &get(item->inode_id)->node;
-            if (item_node->file_type == FileType::Directory && !is_dir_empty(item->inode_id))
+        auto pos = find_diritem_pos(id, name);
+        if (!pos)
+            return false;
+
+        // 以末尾目录项填补空位, 无需墓碑. 要改写的两个目录块先取得,
+        // 被快照共享的块无法复制时不做任何修改
+        const uint64_t items_per_block = sb->data.block_size / sb->data.diritem_size;
+        auto node = get_mut(id);
+        if (!node)
+            return false;
+        const uint64_t old_size = node->size;
+        const uint64_t last = node->size / sb->data.diritem_size - 1;
+        std::shared_ptr<Buffer> src_pin, dst_pin;
+        std::span<uint8_t> src, dst;
+        if (pos->first != last) {
+            src = data_block_mut(node.get(), last / items_per_block, src_pin);
+            dst = data_block_mut(node.get(), pos->first / items_per_block, dst_pin);
+            if (src.empty() || dst.empty()) {
+                spdlog::error("[INodeTable] 目录 {} 修改失败: 无法复制共享盘块", id);
                 return false;
-            if (--item_node->link_cnt == 0) {
-                free_inode(item->inode_id);
             }
-            read_data(id, node->size - sb->data.diritem_size, buffer);
-            write_data(id, i, buffer);
-            node->size -= sb->data.diritem_size;
-            get(id)->dirty = true;
+        }
+        if (!release_diritem_target(id, pos->second))
+            return false;
+
+        if (pos->first != last)
+            std::memcpy(dst.data() + (pos->first % items_per_block) * sb->data.diritem_size,
+                        src.data() + (last % items_per_block) * sb->data.diritem_size,
+                        sb->data.diritem_size);
+        node->size -= sb->data.diritem_size;
+        release_tail_blocks(node.get(), old_size);
+        return true;
+    }
+
+    // 批量删除目录项, 一次扫描定位, 一次按块压缩, 返回实际删除的数量
+    size_t remove_many(uint64_t id, const std::vector<std::string> &names) {
+        std::unordered_set<std::string> targets(names.begin(), names.end());
+        targets.erase(".");
+        targets.erase("..");
+        if (targets.empty())
+            return 0;
+
+        std::vector<std::pair<uint64_t, uint64_t>> matches;
+        for (auto it = data_iter(id); it.valid() && matches.size() < targets.size(); it.next()) {
+            auto view = it.block();
+            auto *items = reinterpret_cast<const DirItem *>(view.data());
+            const uint64_t first = it.offset() / sb->data.diritem_size;
+            for (uint64_t i = 0; i < view.size() / sb->data.diritem_size; i++)
+                if (targets.count(items[i].name))
+                    matches.emplace_back(first + i, items[i].inode_id);
+        }
+        if (matches.empty())
+            return 0;
+
+        // 压缩改写首个匹配项之后的全部目录块, 先全部取得, 失败时不删除任何目录项
+        auto node = get_mut(id);
+        if (!node)
+            return 0;
+        auto blocks = dir_blocks_mut(node.get(), matches.front().first,
+                                     node->size / sb->data.diritem_size - 1);
+        if (blocks.empty())
+            return 0;
+
+        std::vector<uint64_t> holes;
+        for (auto [idx, inode_id] : matches)
+            if (release_diritem_target(id, inode_id))
+                holes.push_back(idx);
+
+        if (!holes.empty())
+            compact_dir(node.get(), blocks, holes);
+        return holes.size();
+    }
+
+    // dst 与 src 共享数据: Direct 数据块或 Index 索引树根节点增加一个引用, 写入时再复制.
+    // 碎片块由多个文件分用, 不记引用计数, 碎片存储的数据直接复制到新的碎片
+    bool clone_data(uint64_t src_id, uint64_t dst_id) {
+        const INode src = *get(src_id);
+        auto dst = get_mut(dst_id);
+        if (!dst)
+            return false;
+        if ((src.storage_type == StorageType::Direct || src.storage_type == StorageType::Index) &&
+            !blkalloc->add_ref(src.block_lba))
+            return false;
+
+        if (dst->storage_type == StorageType::Direct)
+            blkalloc->free_block(dst->block_lba);
+        else if (dst->storage_type == StorageType::Index)
+            blkidxer->free_node(dst->block_lba);
+        else if (dst->storage_type == StorageType::Fragment)
+            fragalloc->free(dst->block_lba, dst->frag_idx, dst->frag_cnt);
+        if (src.storage_type == StorageType::Fragment) {
+            std::memset(dst->inline_data, 0, sb->data.inode_inline_data_size);
+            dst->storage_type = StorageType::Inline;
+            dst->size = 0;
+            if (!to_fragments(dst.get(), src.frag_cnt))
+                return false;
+            std::shared_ptr<const Buffer> pin;
+            std::memcpy(acquire_fragments(dst.get())->data() + dst->frag_idx * FRAGMENT_SIZE,
+                        small_data(&src, pin), src.size);
+            dst->size = src.size;
+            dst->init_size = src.init_size;
             return true;
         }
-        return false;
+        dst->storage_type = src.storage_type;
+        dst->block_lba = src.block_lba;
+        dst->size = src.size;
+        dst->init_size = src.init_size;
+        dst->frag_idx = dst->frag_cnt = 0;
+        std::memcpy(dst->inline_data, src.inline_data, sb->data.inode_inline_data_size);
+        return true;
     }
 
     // TODO: 判断是否存在
     bool get_inode_from_disk(uint64_t id, INode *node) {
-        std::shared_ptr<const Buffer> buffer =
-            iocontext->read_block(id / sb->data.inodes_per_block + sb->data.inode_block_start_lba);
-        std::memcpy(node, buffer->data() + (id % sb->data.inodes_per_block) * sb->data.inode_size,
-                    sb->data.inode_size);
+        *node = backend->load(id);
         return true;
     }
 
     bool write_inode_to_disk(uint64_t inode_id, INode *node) {
-        uint64_t block_lba = inode_id / sb->data.inodes_per_block + sb->data.inode_block_start_lba;
-        std::shared_ptr<Buffer> buffer = iocontext->acquire_block(
-            inode_id / sb->data.inodes_per_block + sb->data.inode_block_start_lba);
-        std::memcpy(buffer->data() + (inode_id % sb->data.inodes_per_block) * sb->data.inode_size,
-                    node, sb->data.inode_size);
+        backend->save(inode_id, *node);
         return true;
     }
 
     std::optional<uint64_t> find_inode_by_name(uint64_t dir_inode_id, std::string name) {
-        INode *dir_inode = &get(dir_inode_id)->node;
-        const uint64_t epoch_num = 1024;
-        for (uint64_t cur_offset = 0; cur_offset < dir_inode->size;
-             cur_offset += epoch_num * sb->data.diritem_size) {
-            uint64_t epoch_size =
-                std::min(epoch_num * sb->data.diritem_size, dir_inode->size - cur_offset);
-            std::vector<uint8_t> buffer(epoch_size);
-            auto size = read_data(dir_inode_id, cur_offset, buffer);
-            buffer.resize(size);
-            for (uint64_t i = 0; i < buffer.size(); i += sb->data.diritem_size) {
-                auto *item = reinterpret_cast<DirItem *>(buffer.data() + i);
-                if (std::string(item->name) == name)
-                    return item->inode_id;
-            }
+        for (auto it = data_iter(dir_inode_id); it.valid(); it.next()) {
+            auto view = it.block();
+            auto *items = reinterpret_cast<const DirItem *>(view.data());
+            for (uint64_t i = 0; i < view.size() / sb->data.diritem_size; i++)
+                if (name == items[i].name)
+                    return items[i].inode_id;
         }
         return std::nullopt;
     }
 
-    INode get_inode_info(uint64_t id) { return get(id)->node; }
+    INode get_inode_info(uint64_t id) { return *get(id); }
 
-    void flush() {
-        for (auto it : cache_list)
-            if (it.dirty)
-                write_inode_to_disk(it.id, &it.node);
-        clear_cache();
+    INodeAttr get_attr(uint64_t id) { return INodeAttr(id, *get(id)); }
+
+    // 批量获取属性, 按 id 顺序访问使同一 INode 块内的未命中只读盘一次
+    std::vector<INodeAttr> get_attrs(std::span<const uint64_t> ids) {
+        std::vector<INodeAttr> rst(ids.size());
+        std::vector<size_t> order(ids.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::sort(order, {}, [&](size_t i) { return ids[i]; });
+        for (size_t i : order)
+            rst[i] = INodeAttr(ids[i], *get(ids[i]));
+        return rst;
+    }
+
+    INodeDataIterator data_iter(uint64_t id, uint64_t offset = 0, uint64_t len = UINT64_MAX) {
+        return INodeDataIterator(sb, iocontext, blkidxer, *get(id), offset, len);
     }
 
-    void clear_cache() {
-        cache_list.clear();
-        cache_mp.clear();
+    void flush() { cache->flush_all(); }
+
+    // 原地回写该文件的脏数据块, 并把缓存中的 INode 写入其 INode 块 (加入运行中的事务).
+    // 索引树节点修改时已在运行中的事务里, 与 INode 块一同随下次提交落盘
+    void flush_file(uint64_t id) {
+        std::vector<uint64_t> lbas;
+        {
+            std::lock_guard lock(dirty_mtx);
+            sync_dirty_epoch();
+            if (auto it = dirty_blocks.find(id); it != dirty_blocks.end()) {
+                lbas.assign(it->second.lbas.begin(), it->second.lbas.end());
+                dirty_blocks.erase(it);
+            }
+        }
+        std::ranges::sort(lbas);
+        iocontext->write_back(lbas);
+        cache->flush_keys(std::span(&id, 1));
     }
 
-    bool is_dir_empty(uint64_t id) {
-        auto it = get(id);
-        return it->node.size == 2 * sb->data.diritem_size;
+    // 丢弃缓存且不回写 (格式化后磁盘内容已失效)
+    void clear_cache() { cache->discard(); }
+
+    bool is_dir_empty(uint64_t id) { return get(id)->size == 2 * sb->data.diritem_size; }
+
+    // 释放尚未链接进父目录的新目录, 同时撤销其 ".." 给父目录增加的链接数
+    void free_unlinked_dir(uint64_t id, uint64_t parent_id) {
+        if (auto parent = get_mut(parent_id))
+            parent->link_cnt--;
+        free_inode(id);
     }
 
 private:
-    std::list<CacheItem>::iterator get(uint64_t id) {
-        if (cache_mp.count(id)) {
-            this->cache_list.splice(cache_list.begin(), cache_list, cache_mp[id]);
-            return cache_mp[id];
+    std::optional<std::pair<uint64_t, uint64_t>> find_diritem_pos(uint64_t dir_inode_id,
+                                                                  const std::string &name) {
+        for (auto it = data_iter(dir_inode_id); it.valid(); it.next()) {
+            auto view = it.block();
+            auto *items = reinterpret_cast<const DirItem *>(view.data());
+            for (uint64_t i = 0; i < view.size() / sb->data.diritem_size; i++)
+                if (name == items[i].name)
+                    return std::make_pair(it.offset() / sb->data.diritem_size + i,
+                                          items[i].inode_id);
+        }
+        return std::nullopt;
+    }
+
+    // 目录项所指INode的引用计数减一, 非空目录或无法复制所在块组时拒绝删除
+    bool release_diritem_target(uint64_t dir_inode_id, uint64_t inode_id) {
+        const bool is_dir = get(inode_id)->file_type == FileType::Directory;
+        if (is_dir && !is_dir_empty(inode_id))
+            return false;
+        if (!unshare_inode(inode_id) || (is_dir && !unshare_inode(dir_inode_id)))
+            return false;
+        if (--get_mut(inode_id)->link_cnt == 0)
+            free_inode(inode_id);
+        // 子目录的 ".." 随之消失
+        if (is_dir)
+            get_mut(dir_inode_id)->link_cnt--;
+        return true;
+    }
+
+    // 目录中第 first 到第 last 个目录项所在各块的可写视图, 共享盘块先复制;
+    // 任一块复制失败时返回空. 各块通过 pin 保持在缓存中
+    struct DirBlocks {
+        uint64_t first_blk = 0;
+        std::vector<std::span<uint8_t>> views;
+        std::vector<std::shared_ptr<Buffer>> pins;
+        bool empty() const { return views.empty(); }
+    };
+    DirBlocks dir_blocks_mut(INode *node, uint64_t first, uint64_t last) {
+        const uint64_t items_per_block = sb->data.block_size / sb->data.diritem_size;
+        DirBlocks blocks;
+        blocks.first_blk = first / items_per_block;
+        for (uint64_t blk = blocks.first_blk; blk <= last / items_per_block; blk++) {
+            auto view = data_block_mut(node, blk, blocks.pins.emplace_back());
+            if (view.empty()) {
+                spdlog::error("[INodeTable] 目录 {} 修改失败: 无法复制共享盘块", node->ID);
+                return {};
+            }
+            blocks.views.push_back(view);
         }
-        if (cache_list.size() < max_cache_size) {
-            INode node;
-            get_inode_from_disk(id, &node);
-            cache_list.push_front(CacheItem{.id = id, .node = node});
-            cache_mp[id] = cache_list.begin();
-            return cache_mp[id];
+        return blocks;
+    }
+    uint8_t *dir_item_mut(DirBlocks &blocks, uint64_t idx) {
+        const uint64_t items_per_block = sb->data.block_size / sb->data.diritem_size;
+        return blocks.views[idx / items_per_block - blocks.first_blk].data() +
+               (idx % items_per_block) * sb->data.diritem_size;
+    }
+
+    // 按块批量前移存活目录项以填补 holes (升序), 并释放尾部盘块.
+    // blocks 覆盖从 holes.front() 到末尾的全部目录项
+    void compact_dir(INode *node, DirBlocks &blocks, const std::vector<uint64_t> &holes) {
+        const uint64_t old_size = node->size;
+        const uint64_t cnt = node->size / sb->data.diritem_size;
+        uint64_t w = holes.front();
+        size_t h = 0;
+        for (uint64_t r = holes.front(); r < cnt; r++) {
+            if (h < holes.size() && holes[h] == r) {
+                h++;
+                continue;
+            }
+            std::memcpy(dir_item_mut(blocks, w), dir_item_mut(blocks, r), sb->data.diritem_size);
+            w++;
         }
+        node->size = w * sb->data.diritem_size;
+        release_tail_blocks(node, old_size);
+    }
 
-        CacheItem old_item = cache_list.back();
-        if (old_item.dirty)
-            write_inode_to_disk(old_item.id, &old_item.node);
-        cache_list.pop_back();
-        cache_mp.erase(old_item.id);
+    // 文件数据第 blk_idx 块的视图, Inline 时为 inode 内联区; 盘块通过 pin 保持在缓存中
+    std::span<const uint8_t> data_block(INode *node, uint64_t blk_idx,
+                                        std::shared_ptr<const Buffer> &pin) {
+        if (node->storage_type == StorageType::Inline)
+            return {reinterpret_cast<const uint8_t *>(node->inline_data),
+                    sb->data.inode_inline_data_size};
+        uint64_t lba = node->storage_type == StorageType::Direct
+                           ? node->block_lba
+                           : blkidxer->find_block(node->block_lba, blk_idx).value_or(0);
+        pin = iocontext->read_block(lba);
+        return {pin->data(), pin->size()};
+    }
 
-        INode node;
-        get_inode_from_disk(id, &node);
-        cache_list.push_front(CacheItem{.id = id, .node = node});
-        cache_mp[id] = cache_list.begin();
-        return cache_mp[id];
+    std::span<uint8_t> data_block_mut(INode *node, uint64_t blk_idx,
+                                      std::shared_ptr<Buffer> &pin) {
+        if (node->storage_type == StorageType::Inline)
+            return {reinterpret_cast<uint8_t *>(node->inline_data),
+                    sb->data.inode_inline_data_size};
+        uint64_t lba = node->storage_type == StorageType::Direct
+                           ? node->block_lba
+                           : blkidxer->find_block(node->block_lba, blk_idx).value_or(0);
+        pin = acquire_content_block(node, blk_idx, lba);
+        if (!pin)
+            return {};
+        return {pin->data(), pin->size()};
+    }
+
+    // 第 blk_idx 个数据块 (位于 lba) 的可写缓冲. 该块被快照共享时先复制到新盘块并更新映射,
+    // 复制失败返回 nullptr. 目录内容属于元数据, 经日志提交; 普通文件数据直接写回
+    std::shared_ptr<Buffer> acquire_content_block(INode *node, uint64_t blk_idx, uint64_t lba) {
+        auto acquire = [&](uint64_t target) {
+            if (node->file_type == FileType::Directory)
+                return iocontext->acquire_block(target);
+            auto buffer = iocontext->acquire_data_block(target);
+            track_dirty(node->ID, target);
+            return buffer;
+        };
+        // 共享的索引树节点先沿路径复制, 使数据块的共享状态体现在其自身的引用计数上
+        if (!unshare_path(node, blk_idx))
+            return nullptr;
+        if (!blkalloc->is_shared(lba))
+            return acquire(lba);
+
+        auto new_lba = blkalloc->allocate_block();
+        if (!new_lba)
+            return nullptr;
+        if (node->storage_type == StorageType::Index) {
+            if (!blkidxer->update_block(node->block_lba, blk_idx, new_lba.value())) {
+                blkalloc->free_block(new_lba.value());
+                return nullptr;
+            }
+        } else {
+            node->block_lba = new_lba.value();
+        }
+        spdlog::debug("[INodeTable] 写时复制数据块 0x{:X} -> 0x{:X}.", lba, new_lba.value());
+        std::shared_ptr<const Buffer> src = iocontext->read_block(lba);
+        std::shared_ptr<Buffer> dst = acquire(new_lba.value());
+        std::memcpy(dst->data(), src->data(), sb->data.block_size);
+        blkalloc->free_block(lba);
+        return dst;
+    }
+
+    // Inline 或 Fragment 存储的数据移入新分配的单个盘块
+    bool to_direct(INode *node) {
+        auto lba = blkalloc->allocate_block();
+        if (!lba)
+            return false;
+        std::shared_ptr<Buffer> buffer = acquire_content_block(node, 0, lba.value());
+        // 新分配的盘块可能残留已释放文件的数据
+        std::ranges::fill(*buffer, 0);
+        std::shared_ptr<const Buffer> pin;
+        std::memcpy(buffer->data(), small_data(node, pin), node->size);
+        release_small(node);
+        node->block_lba = lba.value();
+        node->storage_type = StorageType::Direct;
+        return true;
+    }
+
+    // 只映射第 blk_idx 块, 记为未写入, 由随后的写入清零并填充
+    bool empty_to_index(INode *node, uint64_t blk_idx) {
+        auto lba = blkalloc->allocate_block();
+        if (!lba)
+            return false;
+        auto root = blkidxer->insert_block(0, blk_idx, lba.value());
+        if (!root) {
+            blkalloc->free_block(lba.value());
+            return false;
+        }
+        node->block_lba = root.value();
+        node->storage_type = StorageType::Index;
+        node->init_size = 0;
+        return true;
+    }
+
+    bool direct_to_index(INode *node) {
+        auto root = blkidxer->insert_block(0, 0, node->block_lba);
+        if (!root)
+            return false;
+        node->block_lba = root.value();
+        node->storage_type = StorageType::Index;
+        node->init_size = node->size;
+        return true;
+    }
+
+    // 推进写入水位线到第 blk_idx 块之前: 其间预分配但未写入的块清零
+    bool zero_unwritten(INode *node, uint64_t blk_idx) {
+        const uint64_t init_blk =
+            (node->init_size + sb->data.block_size - 1) / sb->data.block_size;
+        if (blk_idx <= init_blk)
+            return true;
+        for (auto [idx, lba] : blkidxer->scan_blocks(node->block_lba, init_blk, blk_idx - init_blk)) {
+            if (idx >= blk_idx)
+                break;
+            std::shared_ptr<Buffer> buffer = acquire_content_block(node, idx, lba);
+            if (!buffer)
+                return false;
+            std::ranges::fill(*buffer, 0);
+        }
+        node->init_size = blk_idx * sb->data.block_size;
+        return true;
+    }
+
+    // Index 存储只剩第 0 块时转为 Direct: 该块内容复制到新盘块后释放整棵树,
+    // 不为保留原块而引入引用计数. 第 0 块为空洞或未写入时新块全零
+    bool index_to_direct(INode *node) {
+        auto lba = blkalloc->allocate_block();
+        if (!lba)
+            return false;
+        std::shared_ptr<const Buffer> src;
+        if (node->init_size > 0)
+            if (auto old = blkidxer->find_block(node->block_lba, 0))
+                src = iocontext->read_block(old.value());
+        blkidxer->free_node(node->block_lba);
+        node->block_lba = lba.value();
+        node->storage_type = StorageType::Direct;
+        std::shared_ptr<Buffer> dst = acquire_content_block(node, 0, lba.value());
+        if (src)
+            std::memcpy(dst->data(), src->data(), sb->data.block_size);
+        else
+            std::ranges::fill(*dst, 0);
+        return true;
+    }
+
+    // Direct 或 Fragment 存储的数据移入 INode 内联区
+    void to_inline(INode *node) {
+        std::shared_ptr<const Buffer> pin;
+        std::memcpy(node->inline_data, small_data(node, pin), node->size);
+        std::memset(node->inline_data + node->size, 0,
+                    sb->data.inode_inline_data_size - node->size);
+        release_small(node);
+        node->block_lba = 0;
+        node->storage_type = StorageType::Inline;
+    }
+
+    static uint64_t fragments_for(uint64_t size) {
+        return std::max<uint64_t>(1, (size + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE);
+    }
+
+    // 文件将延伸到 end, 超出当前 Inline 或碎片存储的范围: 普通文件不超过 FRAGMENT_MAX_SIZE 时
+    // 放入碎片, 与其它小文件共用碎片块; 目录与更大的文件转为 Direct
+    bool grow_small(INode *node, uint64_t end) {
+        if (node->file_type == FileType::File && end <= FRAGMENT_MAX_SIZE)
+            return reserve_fragments(node, fragments_for(std::max(node->size, end)));
+        return to_direct(node);
+    }
+
+    // 使文件占有至少 cnt 个可原地写入的碎片. 其后的碎片空闲时原位扩展, 否则迁移到新的碎片;
+    // 碎片块可能被快照引用时同样迁移
+    bool reserve_fragments(INode *node, uint64_t cnt) {
+        if (node->storage_type == StorageType::Fragment && !blkalloc->is_shared(node->block_lba)) {
+            if (node->frag_cnt >= cnt)
+                return true;
+            if (fragalloc->extend(node->block_lba, node->frag_idx, node->frag_cnt, cnt)) {
+                std::shared_ptr<Buffer> buffer = acquire_fragments(node);
+                std::fill_n(buffer->begin() + (node->frag_idx + node->frag_cnt) * FRAGMENT_SIZE,
+                            (cnt - node->frag_cnt) * FRAGMENT_SIZE, 0);
+                node->frag_cnt = cnt;
+                return true;
+            }
+        }
+        return to_fragments(node, std::max<uint64_t>(cnt, fragments_for(node->size)));
     }
 
+    // 分配 cnt 个新碎片, 清零后移入 Inline, Direct 或 Fragment 存储的数据并释放原存储
+    bool to_fragments(INode *node, uint64_t cnt) {
+        auto run = fragalloc->allocate(cnt);
+        if (!run)
+            return false;
+        std::shared_ptr<Buffer> buffer = iocontext->acquire_data_block(run->first);
+        track_dirty(node->ID, run->first);
+        uint8_t *dst = buffer->data() + run->second * FRAGMENT_SIZE;
+        std::memset(dst, 0, cnt * FRAGMENT_SIZE);
+        std::shared_ptr<const Buffer> pin;
+        std::memcpy(dst, small_data(node, pin), node->size);
+        release_small(node);
+        node->block_lba = run->first;
+        node->frag_idx = run->second;
+        node->frag_cnt = cnt;
+        node->storage_type = StorageType::Fragment;
+        return true;
+    }
+
+    std::shared_ptr<Buffer> acquire_fragments(INode *node) {
+        track_dirty(node->ID, node->block_lba);
+        return iocontext->acquire_data_block(node->block_lba);
+    }
+
+    // Inline, Direct 或 Fragment 存储的数据起点, 盘块通过 pin 保持在缓存中
+    const uint8_t *small_data(const INode *node, std::shared_ptr<const Buffer> &pin) {
+        if (node->storage_type == StorageType::Inline)
+            return reinterpret_cast<const uint8_t *>(node->inline_data);
+        pin = iocontext->read_block(node->block_lba);
+        if (node->storage_type == StorageType::Fragment)
+            return pin->data() + node->frag_idx * FRAGMENT_SIZE;
+        return pin->data();
+    }
+
+    // 数据移出后释放原存储, 内联区清零
+    void release_small(INode *node) {
+        if (node->storage_type == StorageType::Inline) {
+            std::memset(node->inline_data, 0, node->size);
+        } else if (node->storage_type == StorageType::Direct) {
+            blkalloc->free_block(node->block_lba);
+        } else {
+            fragalloc->free(node->block_lba, node->frag_idx, node->frag_cnt);
+            node->frag_idx = 0;
+            node->frag_cnt = 0;
+        }
+    }
+
+    // 清零同一块内的 [from, to). 空洞与写入水位之后的内容本就读出全零, 跳过
+    bool zero_bytes(INode *node, uint64_t from, uint64_t to) {
+        if (from >= to)
+            return true;
+        if (node->storage_type == StorageType::Inline) {
+            std::memset(node->inline_data + from, 0, to - from);
+            return true;
+        }
+        if (node->storage_type == StorageType::Fragment) {
+            if (!reserve_fragments(node, node->frag_cnt))
+                return false;
+            std::shared_ptr<Buffer> buffer = acquire_fragments(node);
+            std::fill(buffer->begin() + node->frag_idx * FRAGMENT_SIZE + from,
+                      buffer->begin() + node->frag_idx * FRAGMENT_SIZE + to, 0);
+            return true;
+        }
+        const uint64_t blk_idx = from / sb->data.block_size;
+        uint64_t lba = node->block_lba;
+        if (node->storage_type == StorageType::Index) {
+            if (from >= node->init_size)
+                return true;
+            lba = blkidxer->find_block(node->block_lba, blk_idx).value_or(0);
+            if (lba == 0)
+                return true;
+        }
+        std::shared_ptr<Buffer> buffer = acquire_content_block(node, blk_idx, lba);
+        if (!buffer)
+            return false;
+        const uint64_t base = blk_idx * sb->data.block_size;
+        std::fill(buffer->begin() + (from - base), buffer->begin() + (to - base), 0);
+        return true;
+    }
+
+    // 释放 Index 存储中块号 [first, end) 内的数据块与因此变空的索引节点
+    bool release_blocks(INode *node, uint64_t first, uint64_t end) {
+        if (!unshare_path(node, first) || !unshare_path(node, end))
+            return false;
+        blkidxer->erase_blocks(node->block_lba, first, end);
+        return true;
+    }
+
+    // 修改索引树中第 blk_idx 块的映射前, 复制从根到该块所在叶子的路径上被共享的节点.
+    // 与其它文件共享的节点复制后, 其子节点 (或数据块) 的引用计数只下推一级,
+    // 树的其余部分继续共享, 首次写入的代价与文件大小无关
+    bool unshare_path(INode *node, uint64_t blk_idx) {
+        if (node->storage_type != StorageType::Index)
+            return true;
+        // 共享同一棵树的文件各自持有自己的 INode 锁, 复制与下推需互斥
+        std::lock_guard lock(cow_mtx);
+        auto root = blkidxer->unshare_path(node->block_lba, blk_idx);
+        if (!root) {
+            spdlog::error("[INodeTable] 无法复制 INode {} 索引树中第 {} 块的路径.", node->ID,
+                          blk_idx);
+            return false;
+        }
+        node->block_lba = root.value();
+        return true;
+    }
+
+    // 目标第 dst_idx 块改为引用源文件第 src_idx 块. 仅在源块存在且目标已是 Index 存储时进行,
+    // 否则返回 false 由调用方复制数据 (复制会在需要时把目标转为 Index 存储)
+    bool share_block(uint64_t src_id, uint64_t src_idx, uint64_t dst_id, uint64_t dst_idx) {
+        uint64_t lba = 0;
+        {
+            auto src = get(src_id);
+            // 源块未写入时按空洞处理, 由调用方复制出全零
+            if (src->storage_type == StorageType::Index &&
+                src_idx * sb->data.block_size < src->init_size)
+                lba = blkidxer->find_block(src->block_lba, src_idx).value_or(0);
+            else if (src->storage_type == StorageType::Direct && src_idx == 0)
+                lba = src->block_lba;
+        }
+        if (lba == 0 || get(dst_id)->storage_type != StorageType::Index)
+            return false;
+
+        auto dst = get_mut(dst_id);
+        if (!dst || !unshare_path(dst.get(), dst_idx) || !zero_unwritten(dst.get(), dst_idx) ||
+            !blkalloc->add_ref(lba))
+            return false;
+        if (auto old = blkidxer->find_block(dst->block_lba, dst_idx)) {
+            blkidxer->update_block(dst->block_lba, dst_idx, lba);
+            blkalloc->free_block(old.value());
+        } else {
+            auto root = blkidxer->insert_block(dst->block_lba, dst_idx, lba);
+            if (!root) {
+                blkalloc->free_block(lba);
+                return false;
+            }
+            dst->block_lba = root.value();
+        }
+        dst->size = std::max(dst->size, (dst_idx + 1) * sb->data.block_size);
+        dst->init_size = std::max(dst->init_size, (dst_idx + 1) * sb->data.block_size);
+        return true;
+    }
+
+    // 快照之后首次修改块组内的 INode 时, 整个块组复制到新位置并更新映射表, 快照仍引用旧块组
+    bool unshare_chunk(uint64_t id) {
+        std::lock_guard lock(alloc_mtx);
+        const uint64_t old_lba = backend->chunk_lba(id);
+        if (old_lba == 0 || !blkalloc->is_shared(old_lba))
+            return true;
+        auto lba = blkalloc->allocate_extent(sb->data.inode_chunk_blocks);
+        if (!lba)
+            return false;
+        spdlog::debug("[INodeManager] 写时复制INode块组 {}, 0x{:X} -> 0x{:X}",
+                      backend->chunk_idx(id), old_lba, lba.value());
+        for (uint64_t i = 0; i < sb->data.inode_chunk_blocks; i++) {
+            std::shared_ptr<const Buffer> src = iocontext->read_block(old_lba + i);
+            std::memcpy(iocontext->acquire_block(lba.value() + i)->data(), src->data(),
+                        sb->data.block_size);
+        }
+        backend->set_chunk_lba(id, lba.value());
+        return true;
+    }
+
+    // 释放 old_size 时占用而当前 size 不再需要的尾部数据块
+    void release_tail_blocks(INode *node, uint64_t old_size) {
+        node->init_size = std::min(node->init_size, node->size);
+        if (node->storage_type != StorageType::Index)
+            return;
+        const uint64_t keep = (node->size + sb->data.block_size - 1) / sb->data.block_size;
+        const uint64_t used = (old_size + sb->data.block_size - 1) / sb->data.block_size;
+        release_blocks(node, std::max<uint64_t>(keep, 1), used);
+    }
+
+    bool allocate_chunk(uint64_t id) {
+        auto lba = blkalloc->allocate_extent(sb->data.inode_chunk_blocks);
+        if (!lba) {
+            spdlog::warn("[INodeManager] 无法为INode {} 分配块组.", id);
+            return false;
+        }
+        spdlog::debug("[INodeManager] 分配INode块组 {}, LBA: 0x{:X}", backend->chunk_idx(id),
+                      lba.value());
+        backend->set_chunk_lba(id, lba.value());
+        sb->data.allocated_inode_chunks++;
+        return true;
+    }
+
+    uint64_t valid_bits_in_bitmap_block(uint64_t bitmap_block_idx) const {
+        const uint64_t first = bitmap_block_idx * sb->data.bits_per_block;
+        return std::min(sb->data.bits_per_block, sb->data.inodes_cnt - first);
+    }
+
+    // 首次分配时只读扫描一遍 INode 位图, 建立每个位图块的空闲计数
+    void load_inode_free_cnt() {
+        if (!inode_free_cnt.empty())
+            return;
+        inode_free_cnt.resize(sb->data.inode_valid_blocks_cnt);
+        for (uint64_t i = 0; i < sb->data.inode_valid_blocks_cnt; i++) {
+            const uint64_t valid_bits = valid_bits_in_bitmap_block(i);
+            if (sb->block_uninit(i + sb->data.inode_valid_block_start_lba)) {
+                inode_free_cnt[i] = valid_bits;
+                continue;
+            }
+            std::shared_ptr<const Buffer> buffer =
+                iocontext->read_block(i + sb->data.inode_valid_block_start_lba);
+            uint64_t used = 0;
+            for (uint64_t byte_idx = 0; byte_idx < valid_bits / 8; byte_idx++)
+                used += std::popcount((*buffer)[byte_idx]);
+            // 末尾不足一字节的部分按高位在前只统计有效的位
+            if (const uint64_t rem = valid_bits % 8)
+                used += std::popcount(uint8_t((*buffer)[valid_bits / 8] & (0xFF << (8 - rem))));
+            inode_free_cnt[i] = valid_bits - used;
+        }
+    }
+
+    // 在 [from, to) 中查找第一个空闲 INode, 不弄脏位图块
+    std::optional<uint64_t> find_free_inode(uint64_t from, uint64_t to) {
+        const uint64_t bits = sb->data.bits_per_block;
+        for (uint64_t blk = from / bits; blk * bits < to; blk++) {
+            if (inode_free_cnt[blk] == 0)
+                continue;
+            std::shared_ptr<const Buffer> buffer =
+                iocontext->read_block(blk + sb->data.inode_valid_block_start_lba);
+            const uint8_t *bytes = buffer->data();
+            const uint64_t end = std::min(to - blk * bits, bits);
+            uint64_t bit = blk * bits < from ? from - blk * bits : 0;
+            while (bit < end) {
+                // 整 8 字节全满时整体跳过
+                if (bit % 64 == 0 && bit + 64 <= end) {
+                    uint64_t word;
+                    std::memcpy(&word, bytes + bit / 8, sizeof(word));
+                    if (word == UINT64_MAX) {
+                        bit += 64;
+                        continue;
+                    }
+                }
+                if (!(bytes[bit / 8] & (1 << (7 - bit % 8))))
+                    return blk * bits + bit;
+                bit++;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // 在 [from, to) 中查找第一个整块空闲的 INode 块, 返回其首个 INode
+    std::optional<uint64_t> find_free_group(uint64_t from, uint64_t to) {
+        const uint64_t bits = sb->data.bits_per_block;
+        const uint64_t group = sb->data.inodes_per_block;
+        for (uint64_t blk = from / bits; blk * bits < to; blk++) {
+            if (inode_free_cnt[blk] < group)
+                continue;
+            std::shared_ptr<const Buffer> buffer =
+                iocontext->read_block(blk + sb->data.inode_valid_block_start_lba);
+            const uint8_t *bytes = buffer->data();
+            const uint64_t end = std::min(to - blk * bits, bits);
+            uint64_t bit = blk * bits < from ? from - blk * bits : 0;
+            for (bit = (bit + group - 1) / group * group; bit + group <= end; bit += group) {
+                if (std::all_of(bytes + bit / 8, bytes + (bit + group) / 8,
+                                [](uint8_t b) { return b == 0; }))
+                    return blk * bits + bit;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // 在 [from, to) 中按位图顺序收集空闲 INode 直到 ids 达到 cnt 个, 不弄脏位图块.
+    // group 为真时每次取一个整块空闲的 INode 块的首个 INode
+    void collect_free_inodes(uint64_t from, uint64_t to, bool group, size_t cnt,
+                             std::vector<uint64_t> &ids) {
+        const uint64_t bits = sb->data.bits_per_block;
+        const uint64_t step = group ? sb->data.inodes_per_block : 1;
+        for (uint64_t blk = from / bits; blk * bits < to && ids.size() < cnt; blk++) {
+            if (inode_free_cnt[blk] < step)
+                continue;
+            std::shared_ptr<const Buffer> buffer =
+                iocontext->read_block(blk + sb->data.inode_valid_block_start_lba);
+            const uint8_t *bytes = buffer->data();
+            const uint64_t end = std::min(to - blk * bits, bits);
+            uint64_t bit = blk * bits < from ? from - blk * bits : 0;
+            bit = (bit + step - 1) / step * step;
+            while (bit + step <= end && ids.size() < cnt) {
+                // 整 8 字节全满时整体跳过
+                if (bit % 64 == 0 && bit + 64 <= end) {
+                    uint64_t word;
+                    std::memcpy(&word, bytes + bit / 8, sizeof(word));
+                    if (word == UINT64_MAX) {
+                        bit += std::max<uint64_t>(64, step);
+                        continue;
+                    }
+                }
+                const bool free = group ? std::all_of(bytes + bit / 8, bytes + (bit + step) / 8,
+                                                      [](uint8_t b) { return b == 0; })
+                                        : !(bytes[bit / 8] & (1 << (7 - bit % 8)));
+                if (free)
+                    ids.push_back(blk * bits + bit);
+                bit += step;
+            }
+        }
+    }
+
+    // 记录文件弄脏的数据块供 flush_file 使用. 已被淘汰回写的块不再为脏, 集合过大时剔除
+    void track_dirty(uint64_t id, uint64_t lba) {
+        std::lock_guard lock(dirty_mtx);
+        sync_dirty_epoch();
+        auto &dirty = dirty_blocks[id];
+        if (!dirty.lbas.insert(lba).second || dirty.lbas.size() < dirty.prune_at)
+            return;
+        std::erase_if(dirty.lbas, [&](uint64_t b) { return !iocontext->is_dirty(b); });
+        dirty.prune_at = std::max<size_t>(DIRTY_TRACK_PRUNE_MIN, dirty.lbas.size() * 2);
+    }
+
+    // 检查点已回写全部脏块, 之前的记录作废. 调用方持有 dirty_mtx
+    void sync_dirty_epoch() {
+        const uint64_t epoch = iocontext->checkpoint_epoch();
+        if (dirty_epoch == epoch)
+            return;
+        dirty_blocks.clear();
+        dirty_epoch = epoch;
+    }
+
+    // 返回的句柄在持有期间固定缓存条目, 不会因其它访问触发的淘汰而失效.
+    // 所在块组被快照共享且无法复制时 get_mut 返回 nullptr, 调用方放弃本次修改
+    std::shared_ptr<const INode> get(uint64_t id) { return cache->get(id); }
+    std::shared_ptr<INode> get_mut(uint64_t id) {
+        if (!unshare_inode(id)) {
+            spdlog::error("[INodeManager] 无法复制INode {} 所在块组", id);
+            return nullptr;
+        }
+        return cache->get_mut(id);
+    }
+
+    // 确保 INode 所在块组不与快照共享, 之后在同一操作内对它的 get_mut 不会失败.
+    // 需要同时修改多个 INode 的操作先逐个确认, 避免改了一半
+    bool unshare_inode(uint64_t id) { return !sb->data.snapshots_cnt || unshare_chunk(id); }
+
 private:
     std::shared_ptr<SuperBlock> sb;
     std::shared_ptr<IOContext> iocontext;
     std::shared_ptr<BlockAllocator> blkalloc;
     std::shared_ptr<BlockIndexer> blkidxer;
+    std::shared_ptr<FragmentAllocator> fragalloc;
 
-    const uint32_t max_cache_size;
-    std::list<CacheItem> cache_list;
-    std::unordered_map<uint64_t, typename decltype(cache_list)::iterator> cache_mp;
+    std::shared_ptr<INodeCacheBackend> backend;
+    std::unique_ptr<ShardedLRUCache<uint64_t, INode>> cache;
+
+    std::vector<uint64_t> inode_free_cnt;
+    // INode 位图, 空闲计数与块组映射的修改; 分配途中 get_mut 会再次进入, 需可重入
+    std::recursive_mutex alloc_mtx;
+    std::mutex cow_mtx;
+
+    struct DirtyBlocks {
+        std::unordered_set<uint64_t> lbas;
+        size_t prune_at = DIRTY_TRACK_PRUNE_MIN;
+    };
+    std::unordered_map<uint64_t, DirtyBlocks> dirty_blocks;
+    uint64_t dirty_epoch = 0;
+    std::mutex dirty_mtx;
 };
 
-// TODO:
-class INodeDataIterator {};
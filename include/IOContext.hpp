@@ -1,12 +1,14 @@
 #pragma once
 #include "IDisk.hpp"
-#include "LRUCache.hpp"
+#include "Journal.hpp"
+#include "ShardedLRUCache.hpp"
 #include "SuperBlock.hpp"
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <spdlog/spdlog.h>
 
-typedef std::vector<uint8_t> Buffer;
-
 class BlockCacheBackend : public ICacheBackend<uint64_t, std::vector<uint8_t>> {
 public:
     BlockCacheBackend(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IDisk> _disk)
@@ -14,7 +16,7 @@ public:
 
     std::vector<uint8_t> load(uint64_t lba) override {
         std::vector<uint8_t> buffer(sb->data.block_size);
-        if (lba == 0)
+        if (lba == 0 || sb->block_uninit(lba))
             std::ranges::fill(buffer, 0);
         else
             disk->read_block(lba, reinterpret_cast<char *>(buffer.data()));
@@ -32,22 +34,105 @@ private:
     std::shared_ptr<IDisk> disk;
 };
 
+// 盘块缓存分片加锁, 可被多个线程同时访问; 运行中的事务由 journal_mtx 保护.
+// 提交, 检查点与格式化要求调用方保证没有并发的修改 (FileSys 以独占锁调用)
 class IOContext {
 public:
     IOContext(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IDisk> _disk,
               uint32_t _cache_size = 16384)
         : sb(_sb), disk(_disk) {
         auto backend = std::make_shared<BlockCacheBackend>(sb, disk);
-        cache = std::make_unique<LRUCache<uint64_t, std::vector<uint8_t>>>(_cache_size, backend);
+        cache = std::make_unique<ShardedLRUCache<uint64_t, std::vector<uint8_t>>>(_cache_size,
+                                                                                  backend);
+        journal = std::make_shared<Journal>(sb, disk);
     }
 
-    ~IOContext() { flush_all(); }
+    // 正常卸载: 全部落盘后置位干净标志, 下次挂载跳过日志重放
+    ~IOContext() {
+        if (read_only)
+            return;
+        flush_all();
+        sb->data.clean_shutdown = 1;
+        flush_super_block();
+        disk->flush();
+    }
 
+    // 提交运行中的事务并做检查点, 之后缓存中的全部修改均已原地落盘
     void flush_all() {
+        if (read_only)
+            return;
+        commit();
+        checkpoint();
+    }
+
+    void commit() {
+        if (before_commit)
+            before_commit();
+        std::unique_lock lock(journal_mtx);
+        bool committed = journal->commit();
+        if (!committed && journal->fits_empty()) {
+            // 日志剩余空间不足: 先腾空日志再提交
+            lock.unlock();
+            checkpoint_committed();
+            lock.lock();
+            committed = journal->commit();
+        }
+        if (!committed) {
+            spdlog::error("[IOContext] 事务需 {} 个日志块, 超出日志容量 {}, "
+                          "放弃原子性直接原地回写.",
+                          journal->blocks_needed(), sb->data.journal_blocks_cnt);
+            journal->release();
+            lock.unlock();
+            checkpoint();
+            return;
+        }
+        const bool full = journal->need_checkpoint();
+        lock.unlock();
+        if (full)
+            checkpoint();
+    }
+
+    // 先 flush 硬盘使此前原地回写的数据盘块落盘, 再提交引用它们的事务,
+    // 避免提交块先于数据到达磁盘, 重放后元数据指向未写入的盘块
+    void commit_durable() {
+        disk->flush();
+        {
+            std::lock_guard lock(journal_mtx);
+            if (journal->running_blocks() == 0)
+                return;
+        }
+        commit();
+    }
+
+    // 提交前回调, 在运行中的事务写入日志之前调用, 可继续修改元数据
+    void set_before_commit(std::function<void()> fn) { before_commit = std::move(fn); }
+
+    // 盘块被释放, 见 Journal::revoke. 返回 true 时盘块在事务提交前不能再分配
+    bool revoke_block(uint64_t lba) {
+        std::lock_guard lock(journal_mtx);
+        return journal->revoke(lba);
+    }
+
+    bool need_commit() {
+        std::lock_guard lock(journal_mtx);
+        return journal->need_commit();
+    }
+
+    // 挂载时调用: 上次未正常卸载则重放日志, 返回重放的事务数
+    uint64_t recover() {
+        uint64_t replayed = 0;
+        if (sb->data.clean_shutdown)
+            journal->load();
+        else
+            replayed = journal->replay();
+        sb->data.clean_shutdown = 0;
         flush_super_block();
-        cache->flush_all();
+        disk->flush();
+        return replayed;
     }
 
+    void format_journal() { journal->format(); }
+
     void read_super_block() { disk->read_block(0, reinterpret_cast<char *>(sb.get())); }
     void flush_super_block() { disk->write_block(0, reinterpret_cast<char *>(sb.get())); }
 
@@ -57,19 +142,89 @@ public:
         return cache->get(lba);
     }
 
+    // 获取元数据盘块用于修改, 盘块加入运行中的事务, 提交前不会被原地回写
     std::shared_ptr<std::vector<uint8_t>> acquire_block(uint64_t lba) {
+        if (lba == 0)
+            return nullptr;
+        auto buffer = cache->get_mut(lba);
+        sb->clear_block_uninit(lba);
+        std::lock_guard lock(journal_mtx);
+        journal->add(lba, buffer);
+        return buffer;
+    }
+
+    // 获取文件数据盘块用于修改, 不经过日志
+    std::shared_ptr<std::vector<uint8_t>> acquire_data_block(uint64_t lba) {
         if (lba == 0)
             return nullptr;
         return cache->get_mut(lba);
     }
 
+    // 原地回写给定盘块中仍为脏的部分, 不经过日志也不 flush
+    void write_back(std::span<const uint64_t> lbas) { cache->flush_keys(lbas); }
+
+    bool is_dirty(uint64_t lba) { return cache->is_dirty(lba); }
+
+    // 每次检查点后加一, 此前弄脏的盘块均已落盘
+    uint64_t checkpoint_epoch() const { return checkpoints; }
+
+    // 丢弃缓存与运行中事务里的该盘块, 之后的访问重新加载
+    void invalidate_block(uint64_t lba) {
+        cache->remove(lba);
+        std::lock_guard lock(journal_mtx);
+        journal->remove(lba);
+    }
+
+    // 只读挂载 (快照) 不回写任何内容, 也不修改超级块
+    void set_read_only() { read_only = true; }
+
+    // 硬盘内容即将被清空, 缓存中的脏块无需回写
     void clear() {
-        cache->clear();
+        cache->discard();
+        {
+            std::lock_guard lock(journal_mtx);
+            journal->release();
+        }
         disk->clear();
     }
 
+private:
+    // 运行中的事务尚未提交时的检查点: 其盘块不能原地回写, 改由日志写回其已提交的版本
+    void checkpoint_committed() {
+        std::vector<uint64_t> pinned;
+        {
+            std::lock_guard lock(journal_mtx);
+            pinned = journal->running_lbas();
+        }
+        cache->flush_all(pinned);
+        disk->flush();
+        {
+            std::lock_guard lock(journal_mtx);
+            journal->checkpoint_committed(pinned);
+        }
+        checkpoints++;
+    }
+
+    // 运行中的事务须为空: 全部脏块原地落盘后日志即可从头复用
+    void checkpoint() {
+        cache->flush_all();
+        disk->flush();
+        {
+            std::lock_guard lock(journal_mtx);
+            journal->reset();
+        }
+        flush_super_block();
+        disk->flush();
+        checkpoints++;
+    }
+
 private:
     std::shared_ptr<IDisk> disk;
     std::shared_ptr<SuperBlock> sb;
-    std::unique_ptr<LRUCache<uint64_t, std::vector<uint8_t>>> cache;
+    std::unique_ptr<ShardedLRUCache<uint64_t, std::vector<uint8_t>>> cache;
+    std::shared_ptr<Journal> journal;
+    std::mutex journal_mtx;
+    std::atomic<uint64_t> checkpoints = 0;
+    std::function<void()> before_commit;
+    bool read_only = false;
 };
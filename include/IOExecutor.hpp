@@ -0,0 +1,127 @@
+#pragma once
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// 异步 I/O 执行器. 固定数量的工作线程从有界队列中取出请求, 各自同步执行文件系统调用,
+// 完成后由该工作线程恢复等待的协程. 完成并非来自 IDisk 后端, 同时在途的请求数不超过工作线程数,
+// 其余在队列中等待. 队列为侵入式链表, 节点就是协程帧中的等待体, 入队不分配内存
+class IOExecutor {
+public:
+    class Request {
+    public:
+        // 执行请求并恢复等待方, 返回后请求可能已被销毁
+        virtual void run() = 0;
+
+    protected:
+        ~Request() = default;
+
+    private:
+        friend class IOExecutor;
+        Request *next = nullptr;
+    };
+
+    IOExecutor(size_t worker_cnt, size_t _queue_depth) : queue_depth(_queue_depth) {
+        for (size_t i = 0; i < worker_cnt; i++)
+            workers.emplace_back([this] { work(); });
+    }
+
+    // 等待队列中已有的请求全部完成后退出
+    ~IOExecutor() {
+        {
+            std::lock_guard lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    // 队列已满时返回 false, 调用方应在当前线程直接执行请求
+    bool try_submit(Request *req) {
+        {
+            std::lock_guard lock(mtx);
+            if (queued >= queue_depth)
+                return false;
+            req->next = nullptr;
+            if (tail)
+                tail->next = req;
+            else
+                head = req;
+            tail = req;
+            queued++;
+        }
+        cv.notify_one();
+        return true;
+    }
+
+private:
+    void work() {
+        while (true) {
+            Request *req;
+            {
+                std::unique_lock lock(mtx);
+                cv.wait(lock, [this] { return head || stopping; });
+                if (!head)
+                    return;
+                req = head;
+                head = head->next;
+                if (!head)
+                    tail = nullptr;
+                queued--;
+            }
+            req->run();
+        }
+    }
+
+private:
+    const size_t queue_depth;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    Request *head = nullptr;
+    Request *tail = nullptr;
+    size_t queued = 0;
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+};
+
+// co_await 时把 op 交给执行器, 完成后以 op 的返回值恢复协程.
+// 队列已满时直接在当前线程执行 op 且不挂起, 以此对提交方施加背压
+template <typename Op>
+class IOAwaitable : public IOExecutor::Request {
+public:
+    using Result = std::invoke_result_t<Op &>;
+
+    IOAwaitable(IOExecutor *_executor, Op _op) : executor(_executor), op(std::move(_op)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> _handle) {
+        handle = _handle;
+        // 提交成功后协程随时可能在工作线程上恢复, 不能再访问 this
+        if (executor->try_submit(this))
+            return true;
+        result.emplace(op());
+        return false;
+    }
+
+    Result await_resume() { return std::move(*result); }
+
+    void run() override {
+        result.emplace(op());
+        handle.resume();
+    }
+
+private:
+    IOExecutor *executor;
+    Op op;
+    std::coroutine_handle<> handle;
+    std::optional<Result> result;
+};
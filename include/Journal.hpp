@@ -0,0 +1,381 @@
+#pragma once
+#include "Fnv1aHash.hpp"
+#include "IDisk.hpp"
+#include "SuperBlock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <span>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+typedef std::vector<uint8_t> Buffer;
+
+enum class JournalBlockType : uint64_t {
+    Descriptor = 1,
+    Commit = 2,
+    Revoke = 3,
+};
+
+// 描述块: 头部后紧跟 cnt 个 LBA, 之后依次是这些盘块的副本
+// 撤销块: 头部后紧跟 cnt 个已释放盘块的 LBA, 重放时不再写入更早事务中它们的副本
+// 提交块: cnt 为事务内盘块总数, checksum 覆盖所有 LBA, 盘块副本与撤销的 LBA
+struct JournalHeader {
+    uint64_t magic;
+    JournalBlockType type;
+    uint64_t seq;
+    uint64_t cnt;
+    uint64_t checksum;
+};
+
+// 元数据预写日志. 运行中的事务持有其修改过的元数据盘块, 使其在提交前不会被缓存原地回写;
+// 多个操作的修改合并到同一事务中一次提交, 每次提交只需一次 flush.
+// 日志区从头顺序写入, 检查点后回到开头, 以序号区分新旧记录. LBA 0 表示超级块副本
+class Journal {
+public:
+    Journal(std::shared_ptr<SuperBlock> _sb, std::shared_ptr<IDisk> _disk) : sb(_sb), disk(_disk) {}
+
+    void add(uint64_t lba, std::shared_ptr<Buffer> buffer) { running.emplace(lba, buffer); }
+
+    void remove(uint64_t lba) { running.erase(lba); }
+
+    size_t running_blocks() const { return running.size() + revoked.size(); }
+
+    // 盘块被释放: 丢弃运行中事务里的副本, 日志中仍有已提交的副本时随事务写入撤销记录,
+    // 避免重放用旧副本覆盖之后写入的数据. 返回盘块是否经过日志, 是则提交前不能再分配
+    bool revoke(uint64_t lba) {
+        const bool in_running = running.erase(lba) > 0;
+        if (!logged.contains(lba))
+            return in_running;
+        revoked.push_back(lba);
+        return true;
+    }
+
+    bool need_commit() const { return running.size() >= sb->data.journal_blocks_cnt / 16; }
+
+    // 日志剩余空间不足以容纳一个最大事务时需要检查点
+    bool need_checkpoint() const {
+        return head + sb->data.journal_blocks_cnt / 4 > sb->data.journal_blocks_cnt;
+    }
+
+    // 写入描述块, 盘块副本与提交块后 flush 一次. 空间不足时返回 false, 事务保持不变
+    bool commit() {
+        if (running.empty() && revoked.empty())
+            return true;
+
+        const uint64_t per_desc = lbas_per_descriptor();
+        const uint64_t cnt = running.size() + 1;
+        if (head + blocks_needed() > sb->data.journal_blocks_cnt) {
+            spdlog::warn("[Journal] 事务 {} 共 {} 块, 超出日志剩余空间.", seq, cnt);
+            return false;
+        }
+        spdlog::debug("[Journal] 提交事务 {}, 共 {} 块.", seq, cnt);
+
+        std::vector<std::pair<uint64_t, const uint8_t *>> blocks;
+        blocks.reserve(cnt);
+        blocks.emplace_back(0, reinterpret_cast<const uint8_t *>(sb.get()));
+        for (auto &[lba, buffer] : running)
+            blocks.emplace_back(lba, buffer->data());
+
+        uint64_t checksum = FNV_OFFSET_BASIS;
+        std::vector<uint8_t> desc(sb->data.block_size);
+        for (uint64_t i = 0; i < cnt; i += per_desc) {
+            const uint64_t n = std::min(per_desc, cnt - i);
+            std::ranges::fill(desc, 0);
+            auto header = reinterpret_cast<JournalHeader *>(desc.data());
+            *header = JournalHeader{.magic = MAGIC_NUMBER,
+                                    .type = JournalBlockType::Descriptor,
+                                    .seq = seq,
+                                    .cnt = n,
+                                    .checksum = 0};
+            auto lbas = reinterpret_cast<uint64_t *>(desc.data() + sizeof(JournalHeader));
+            for (uint64_t j = 0; j < n; j++)
+                lbas[j] = blocks[i + j].first;
+            write_journal_block(desc.data());
+
+            for (uint64_t j = 0; j < n; j++) {
+                checksum = fnv1a_hash(&blocks[i + j].first, sizeof(uint64_t), checksum);
+                checksum = fnv1a_hash(blocks[i + j].second, sb->data.block_size, checksum);
+                logged[blocks[i + j].first] = head;
+                write_journal_block(blocks[i + j].second);
+            }
+        }
+
+        for (uint64_t i = 0; i < revoked.size(); i += per_desc) {
+            const uint64_t n = std::min<uint64_t>(per_desc, revoked.size() - i);
+            std::ranges::fill(desc, 0);
+            *reinterpret_cast<JournalHeader *>(desc.data()) =
+                JournalHeader{.magic = MAGIC_NUMBER,
+                              .type = JournalBlockType::Revoke,
+                              .seq = seq,
+                              .cnt = n,
+                              .checksum = 0};
+            std::memcpy(desc.data() + sizeof(JournalHeader), revoked.data() + i,
+                        n * sizeof(uint64_t));
+            checksum = fnv1a_hash(revoked.data() + i, n * sizeof(uint64_t), checksum);
+            write_journal_block(desc.data());
+        }
+
+        std::ranges::fill(desc, 0);
+        *reinterpret_cast<JournalHeader *>(desc.data()) =
+            JournalHeader{.magic = MAGIC_NUMBER,
+                          .type = JournalBlockType::Commit,
+                          .seq = seq,
+                          .cnt = cnt,
+                          .checksum = checksum};
+        write_journal_block(desc.data());
+        disk->flush();
+
+        seq++;
+        running.clear();
+        // 撤销的盘块只能在之后的事务中重新记入日志
+        for (uint64_t lba : revoked)
+            logged.erase(lba);
+        revoked.clear();
+        return true;
+    }
+
+    // 事务连同描述块, 撤销块与提交块所需的日志块数
+    uint64_t blocks_needed() const {
+        const uint64_t per_desc = lbas_per_descriptor();
+        const uint64_t cnt = running.size() + 1;
+        return (cnt + per_desc - 1) / per_desc + cnt + (revoked.size() + per_desc - 1) / per_desc +
+               1;
+    }
+
+    // 事务在日志为空时能否提交
+    bool fits_empty() const { return blocks_needed() <= sb->data.journal_blocks_cnt; }
+
+    // 运行中事务涉及的盘块 (含撤销的), 按 LBA 排序
+    std::vector<uint64_t> running_lbas() const {
+        std::vector<uint64_t> lbas;
+        for (auto &[lba, buffer] : running)
+            lbas.push_back(lba);
+        lbas.insert(lbas.end(), revoked.begin(), revoked.end());
+        std::ranges::sort(lbas);
+        return lbas;
+    }
+
+    // 运行中的事务尚未提交时腾空日志: 调用方已回写了其余全部脏块, 这里把 lbas 在日志中
+    // 最新的已提交副本写回原位, 再以最新提交的超级块副本标记日志为空
+    void checkpoint_committed(std::span<const uint64_t> lbas) {
+        std::vector<uint8_t> data(sb->data.block_size);
+        auto restore = [&](uint64_t lba) {
+            auto it = logged.find(lba);
+            if (it == logged.end())
+                return false;
+            disk->read_block(sb->data.journal_start_lba + it->second,
+                             reinterpret_cast<char *>(data.data()));
+            return true;
+        };
+        for (uint64_t lba : lbas)
+            if (lba != 0 && restore(lba))
+                disk->write_block(lba, reinterpret_cast<const char *>(data.data()));
+        disk->flush();
+
+        if (restore(0)) {
+            reinterpret_cast<SuperBlock *>(data.data())->data.journal_seq = seq;
+            disk->write_block(0, reinterpret_cast<const char *>(data.data()));
+            disk->flush();
+        }
+        reset();
+    }
+
+    // 放弃运行中的事务, 其修改仍留在缓存中
+    void release() {
+        running.clear();
+        revoked.clear();
+    }
+
+    // 检查点完成后调用: 日志中的记录均已原地落盘, 下一事务从日志区开头写入
+    void reset() {
+        head = 0;
+        logged.clear();
+        sb->data.journal_seq = seq;
+    }
+
+    // 格式化时调用, 日志区首块清零保证不会重放旧记录
+    void format() {
+        release();
+        logged.clear();
+        head = 0;
+        seq = sb->data.journal_seq;
+        std::vector<uint8_t> zero(sb->data.block_size, 0);
+        disk->write_block(sb->data.journal_start_lba, reinterpret_cast<const char *>(zero.data()));
+    }
+
+    // 从超级块恢复日志位置, 用于正常卸载后的挂载
+    void load() {
+        release();
+        logged.clear();
+        head = 0;
+        seq = sb->data.journal_seq;
+    }
+
+    // 挂载时从上次检查点起重放所有完整且校验通过的事务, 返回重放的事务数.
+    // 日志区按大块顺序读入, 各事务的校验并行进行, 同一盘块只写入最新的版本
+    uint64_t replay() {
+        load();
+
+        std::vector<uint8_t> image;
+        std::vector<ReplayTx> txs;
+        scan(image, txs);
+
+        std::vector<uint8_t> valid(txs.size(), 0);
+        std::atomic<size_t> next = 0;
+        auto verify = [&] {
+            for (size_t i = next++; i < txs.size(); i = next++) {
+                uint64_t checksum = FNV_OFFSET_BASIS;
+                for (auto [lba, pos] : txs[i].blocks) {
+                    checksum = fnv1a_hash(&lba, sizeof(uint64_t), checksum);
+                    checksum = fnv1a_hash(image.data() + pos * sb->data.block_size,
+                                          sb->data.block_size, checksum);
+                }
+                checksum = fnv1a_hash(txs[i].revoked.data(),
+                                      txs[i].revoked.size() * sizeof(uint64_t), checksum);
+                valid[i] = checksum == txs[i].checksum;
+            }
+        };
+        const size_t worker_cnt =
+            std::min<size_t>(txs.size(), std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < worker_cnt; i++)
+            workers.emplace_back(verify);
+        verify();
+        for (auto &worker : workers)
+            worker.join();
+
+        uint64_t replayed = 0;
+        while (replayed < txs.size() && valid[replayed])
+            replayed++;
+        if (replayed < txs.size())
+            spdlog::warn("[Journal] 事务 {} 校验失败, 丢弃其后的记录.", txs[replayed].seq);
+
+        // 盘块在某事务中被撤销后, 只有同一或之后的事务中的副本有效
+        std::map<uint64_t, uint64_t> revoked_seq;
+        for (uint64_t i = 0; i < replayed; i++)
+            for (uint64_t lba : txs[i].revoked)
+                revoked_seq[lba] = txs[i].seq;
+        std::map<uint64_t, uint64_t> latest;
+        for (uint64_t i = 0; i < replayed; i++)
+            for (auto [lba, pos] : txs[i].blocks) {
+                auto it = revoked_seq.find(lba);
+                if (it == revoked_seq.end() || it->second <= txs[i].seq)
+                    latest[lba] = pos;
+            }
+
+        spdlog::info("[Journal] 重放 {} 个事务, 共 {} 个盘块.", replayed, latest.size());
+        for (auto [lba, pos] : latest) {
+            const uint8_t *data = image.data() + pos * sb->data.block_size;
+            if (lba == 0)
+                apply_super_block(data);
+            else
+                disk->write_block(lba, reinterpret_cast<const char *>(data));
+        }
+        disk->flush();
+
+        seq = sb->data.journal_seq + replayed;
+        sb->data.journal_seq = seq;
+        return replayed;
+    }
+
+private:
+    struct ReplayTx {
+        uint64_t seq;
+        uint64_t checksum;
+        // (LBA, 盘块副本在日志区内的位置)
+        std::vector<std::pair<uint64_t, uint64_t>> blocks;
+        std::vector<uint64_t> revoked;
+    };
+
+    // 顺序解析日志区, 按需以 JOURNAL_REPLAY_READ_BLOCKS 为单位读入 image,
+    // 收集序号连续且带提交块的事务, 不做校验
+    void scan(std::vector<uint8_t> &image, std::vector<ReplayTx> &txs) {
+        const uint64_t blocks_cnt = sb->data.journal_blocks_cnt;
+        uint64_t loaded = 0;
+        auto ensure = [&](uint64_t end) {
+            if (end > blocks_cnt)
+                return false;
+            while (loaded < end) {
+                const uint64_t cnt = std::min<uint64_t>(JOURNAL_REPLAY_READ_BLOCKS,
+                                                        blocks_cnt - loaded);
+                image.resize((loaded + cnt) * sb->data.block_size);
+                disk->read_blocks(sb->data.journal_start_lba + loaded, cnt,
+                                  reinterpret_cast<char *>(image.data()) +
+                                      loaded * sb->data.block_size);
+                loaded += cnt;
+            }
+            return true;
+        };
+
+        const uint64_t per_desc = lbas_per_descriptor();
+        uint64_t pos = 0;
+        ReplayTx tx{.seq = seq, .checksum = 0, .blocks = {}, .revoked = {}};
+        while (ensure(pos + 1)) {
+            auto header =
+                reinterpret_cast<const JournalHeader *>(image.data() + pos * sb->data.block_size);
+            if (header->magic != MAGIC_NUMBER || header->seq != tx.seq)
+                return;
+            if (header->type == JournalBlockType::Commit) {
+                if (header->cnt != tx.blocks.size())
+                    return;
+                tx.checksum = header->checksum;
+                txs.push_back(std::move(tx));
+                tx = ReplayTx{
+                    .seq = txs.back().seq + 1, .checksum = 0, .blocks = {}, .revoked = {}};
+                pos++;
+                continue;
+            }
+            if (header->cnt > per_desc)
+                return;
+            if (header->type == JournalBlockType::Revoke) {
+                auto lbas = reinterpret_cast<const uint64_t *>(header + 1);
+                tx.revoked.insert(tx.revoked.end(), lbas, lbas + header->cnt);
+                pos++;
+                continue;
+            }
+            if (header->type != JournalBlockType::Descriptor)
+                return;
+            const uint64_t cnt = header->cnt;
+            if (!ensure(pos + 1 + cnt))
+                return;
+
+            // ensure 可能使 image 重新分配, 需重新取描述块地址
+            auto lbas = reinterpret_cast<const uint64_t *>(image.data() +
+                                                           pos * sb->data.block_size +
+                                                           sizeof(JournalHeader));
+            for (uint64_t i = 0; i < cnt; i++)
+                tx.blocks.emplace_back(lbas[i], pos + 1 + i);
+            pos += 1 + cnt;
+        }
+    }
+
+    uint64_t lbas_per_descriptor() const {
+        return (sb->data.block_size - sizeof(JournalHeader)) / sizeof(uint64_t);
+    }
+
+    void write_journal_block(const uint8_t *data) {
+        disk->write_block(sb->data.journal_start_lba + head++, reinterpret_cast<const char *>(data));
+    }
+
+    // 日志自身的位置与序号以当前超级块为准
+    void apply_super_block(const uint8_t *data) {
+        const uint64_t journal_seq = sb->data.journal_seq;
+        std::memcpy(sb.get(), data, sizeof(SuperBlock));
+        sb->data.journal_seq = journal_seq;
+    }
+
+private:
+    std::shared_ptr<SuperBlock> sb;
+    std::shared_ptr<IDisk> disk;
+
+    std::map<uint64_t, std::shared_ptr<Buffer>> running;
+    std::vector<uint64_t> revoked;
+    // 检查点以来各盘块最新的已提交副本在日志区内的位置
+    std::map<uint64_t, uint64_t> logged;
+    uint64_t head = 0;
+    uint64_t seq = 1;
+};
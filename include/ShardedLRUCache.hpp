@@ -0,0 +1,183 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+template <typename Key, typename Val>
+struct ICacheBackend {
+    virtual ~ICacheBackend() = default;
+    virtual Val load(Key key) = 0;
+    virtual void save(Key, const Val &val) = 0;
+
+    // 批量回写, items 已按 key 升序排列; 后端可据此合并相邻条目的写入
+    virtual void save_many(std::span<const std::pair<Key, const Val *>> items) {
+        for (auto [key, val] : items)
+            save(key, *val);
+    }
+};
+
+// 线程安全的分片 LRU 缓存. 返回的 shared_ptr 即固定句柄: 持有期间条目不会被淘汰,
+// 淘汰从各分片 LRU 尾部进行, 遇到被固定的条目时将其移回头部, 均摊 O(1)
+template <typename Key, typename Val, size_t ShardCnt = 16>
+class ShardedLRUCache {
+    struct CacheItem {
+        Key key;
+        std::shared_ptr<Val> val;
+        bool dirty = false;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<CacheItem> cache_list;
+        std::unordered_map<Key, typename std::list<CacheItem>::iterator> cache_map;
+    };
+
+public:
+    ShardedLRUCache(size_t _capacity, std::shared_ptr<ICacheBackend<Key, Val>> _backend)
+        : shard_capacity(std::max<size_t>(1, _capacity / ShardCnt)), backend(_backend) {}
+    ~ShardedLRUCache() { flush_all(); }
+
+    std::shared_ptr<const Val> get(Key key) {
+        auto &shard = shard_of(key);
+        std::lock_guard lock(shard.mtx);
+        return access(shard, key)->val;
+    }
+
+    std::shared_ptr<Val> get_mut(Key key) {
+        auto &shard = shard_of(key);
+        std::lock_guard lock(shard.mtx);
+        auto it = access(shard, key);
+        it->dirty = true;
+        return it->val;
+    }
+
+    // 收集所有脏条目按 key 排序后一次性交给后端, 使后端可按所在盘块合并回写.
+    // skip (已排序) 中的条目不回写, 保持为脏
+    void flush_all(std::span<const Key> skip = {}) {
+        std::vector<std::pair<Key, std::shared_ptr<Val>>> dirty_items;
+        for (auto &shard : shards) {
+            std::lock_guard lock(shard.mtx);
+            for (auto &item : shard.cache_list)
+                if (!std::ranges::binary_search(skip, item.key))
+                    take_dirty(item, dirty_items);
+        }
+        write_back(dirty_items);
+    }
+
+    // 只回写 keys 中仍在缓存且为脏的条目
+    void flush_keys(std::span<const Key> keys) {
+        std::vector<std::pair<Key, std::shared_ptr<Val>>> dirty_items;
+        for (Key key : keys) {
+            auto &shard = shard_of(key);
+            std::lock_guard lock(shard.mtx);
+            if (auto it = shard.cache_map.find(key); it != shard.cache_map.end())
+                take_dirty(*it->second, dirty_items);
+        }
+        write_back(dirty_items);
+    }
+
+    bool is_dirty(Key key) {
+        auto &shard = shard_of(key);
+        std::lock_guard lock(shard.mtx);
+        auto it = shard.cache_map.find(key);
+        return it != shard.cache_map.end() && it->second->dirty;
+    }
+
+    void clear() {
+        flush_all();
+        discard();
+    }
+
+    // 丢弃所有未被固定的条目且不回写, 用于格式化后缓存内容已失效的场景
+    void discard() {
+        for (auto &shard : shards) {
+            std::lock_guard lock(shard.mtx);
+            for (auto it = shard.cache_list.begin(); it != shard.cache_list.end();) {
+                if (it->val.use_count() != 1) {
+                    it++;
+                    continue;
+                }
+                shard.cache_map.erase(it->key);
+                it = shard.cache_list.erase(it);
+            }
+        }
+    }
+
+    void remove(Key key) {
+        auto &shard = shard_of(key);
+        std::lock_guard lock(shard.mtx);
+        auto it = shard.cache_map.find(key);
+        if (it == shard.cache_map.end())
+            return;
+        shard.cache_list.erase(it->second);
+        shard.cache_map.erase(it);
+    }
+
+private:
+    Shard &shard_of(Key key) { return shards[std::hash<Key>{}(key) % ShardCnt]; }
+
+    static void take_dirty(CacheItem &item,
+                           std::vector<std::pair<Key, std::shared_ptr<Val>>> &dirty_items) {
+        if (!item.dirty)
+            return;
+        // 仍被持有的条目可能继续被修改, 保留脏标记
+        item.dirty = item.val.use_count() != 1;
+        dirty_items.emplace_back(item.key, item.val);
+    }
+
+    void write_back(std::vector<std::pair<Key, std::shared_ptr<Val>>> &dirty_items) {
+        if (dirty_items.empty())
+            return;
+
+        std::ranges::sort(dirty_items, {}, &std::pair<Key, std::shared_ptr<Val>>::first);
+        std::vector<std::pair<Key, const Val *>> items;
+        items.reserve(dirty_items.size());
+        for (auto &[key, val] : dirty_items)
+            items.emplace_back(key, val.get());
+        backend->save_many(items);
+    }
+
+    typename std::list<CacheItem>::iterator access(Shard &shard, Key key) {
+        if (auto it = shard.cache_map.find(key); it != shard.cache_map.end()) {
+            shard.cache_list.splice(shard.cache_list.begin(), shard.cache_list, it->second);
+            return it->second;
+        }
+
+        if (shard.cache_list.size() >= shard_capacity)
+            evict(shard);
+
+        auto val = std::make_shared<Val>(backend->load(key));
+        shard.cache_list.push_front(CacheItem{.key = key, .val = val, .dirty = false});
+        shard.cache_map[key] = shard.cache_list.begin();
+        return shard.cache_list.begin();
+    }
+
+    void evict(Shard &shard) {
+        // 全部被固定时允许分片暂时超出容量
+        for (size_t tries = shard.cache_list.size(); tries > 0; tries--) {
+            auto it = std::prev(shard.cache_list.end());
+            if (it->val.use_count() != 1) {
+                shard.cache_list.splice(shard.cache_list.begin(), shard.cache_list, it);
+                continue;
+            }
+
+            if (it->dirty)
+                backend->save(it->key, *it->val);
+
+            shard.cache_map.erase(it->key);
+            shard.cache_list.erase(it);
+            return;
+        }
+    }
+
+private:
+    const size_t shard_capacity;
+    std::shared_ptr<ICacheBackend<Key, Val>> backend;
+    std::array<Shard, ShardCnt> shards;
+};
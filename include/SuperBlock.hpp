@@ -1,5 +1,7 @@
 #pragma once
 #include "macros.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 
 union SuperBlock {
@@ -25,10 +27,21 @@ union SuperBlock {
         uint64_t free_inodes;
         uint64_t inode_valid_block_start_lba;
         uint64_t inode_valid_blocks_cnt;
-        uint64_t inode_block_start_lba;
-        uint64_t inode_blocks_cnt;
+        uint64_t inode_chunk_blocks;
+        uint64_t inode_chunks_cnt;
+        uint64_t inode_chunk_map_start_lba;
+        uint64_t inode_chunk_map_blocks_cnt;
+        uint64_t allocated_inode_chunks;
         uint64_t inode_inline_data_size;
 
+        uint64_t journal_start_lba;
+        uint64_t journal_blocks_cnt;
+        uint64_t journal_seq;
+        uint64_t clean_shutdown;
+
+        uint64_t cow_bitmap_start_lba;
+        uint64_t cow_bitmap_blocks_cnt;
+
         uint64_t basic_blocks_cnt;
 
         uint64_t diritem_size;
@@ -38,12 +51,53 @@ union SuperBlock {
 
         uint32_t bloom_bits;
         uint16_t filename_size;
+
+        uint64_t inode_alloc_hint;
+
+        uint64_t refcount_root;
+        uint64_t fragment_root;
+
+        uint64_t snapshots_cnt;
+        uint64_t snapshot_lbas[MAX_SNAPSHOTS];
+
+        // 从 bitmap_block_start_lba 起每个元数据块一位, 置位表示尚未初始化, 读取时视为全 0
+        uint8_t uninit_flags[LAZY_INIT_FLAGS_SIZE];
     } data;
     char padding[BLOCK_SIZE];
 
     bool valid() {
         return this->data.magic_number == MAGIC_NUMBER && this->data.version == VERSION;
     }
+
+    bool block_uninit(uint64_t lba) const {
+        if (lba < data.bitmap_block_start_lba || lba >= data.basic_blocks_cnt)
+            return false;
+        uint64_t idx = lba - data.bitmap_block_start_lba;
+        return idx < LAZY_INIT_FLAGS_SIZE * 8 && (flag_byte(idx).load() & (1 << (7 - idx % 8)));
+    }
+
+    // 超出标志位覆盖范围时返回 false, 由调用方立即写入
+    bool mark_block_uninit(uint64_t lba) {
+        if (lba < data.bitmap_block_start_lba || lba >= data.basic_blocks_cnt)
+            return false;
+        uint64_t idx = lba - data.bitmap_block_start_lba;
+        if (idx >= LAZY_INIT_FLAGS_SIZE * 8)
+            return false;
+        flag_byte(idx).fetch_or(1 << (7 - idx % 8));
+        return true;
+    }
+
+    void clear_block_uninit(uint64_t lba) {
+        if (!block_uninit(lba))
+            return;
+        uint64_t idx = lba - data.bitmap_block_start_lba;
+        flag_byte(idx).fetch_and(static_cast<uint8_t>(~(1 << (7 - idx % 8))));
+    }
+
+    // 同一字节的标志位分属不同盘块, 可能被并发读取与清除, 按字节原子访问
+    std::atomic_ref<uint8_t> flag_byte(uint64_t idx) const {
+        return std::atomic_ref<uint8_t>(const_cast<uint8_t &>(data.uninit_flags[idx / 8]));
+    }
 };
 static_assert(sizeof(SuperBlock) == BLOCK_SIZE);
 
@@ -74,16 +128,39 @@ inline const SuperBlock create_superblock(uint32_t disk_size_gb) {
     rst.data.inode_valid_block_start_lba =
         rst.data.bitmap_block_start_lba + rst.data.bitmap_blocks_cnt;
 
-    rst.data.inode_blocks_cnt = (((1ull << 30) / rst.data.block_size) >> 7) * rst.data.disk_size_gb;
-    rst.data.inodes_cnt = rst.data.inodes_per_block * rst.data.inode_blocks_cnt;
+    // INode 表不再预留, 按块组 (chunk) 从数据区按需分配, 此处只确定 INode 数上限
+    uint64_t max_inode_blocks = (((1ull << 30) / rst.data.block_size) >> 7) * rst.data.disk_size_gb;
+    rst.data.inode_chunk_blocks = INODE_CHUNK_BLOCKS;
+    rst.data.inode_chunks_cnt =
+        (max_inode_blocks + rst.data.inode_chunk_blocks - 1) / rst.data.inode_chunk_blocks;
+    rst.data.inodes_cnt =
+        rst.data.inodes_per_block * rst.data.inode_chunk_blocks * rst.data.inode_chunks_cnt;
     rst.data.free_inodes = rst.data.inodes_cnt;
     rst.data.inode_valid_blocks_cnt =
         (rst.data.inodes_cnt + rst.data.bits_per_block - 1) / rst.data.bits_per_block;
-    rst.data.inode_block_start_lba =
+
+    rst.data.inode_chunk_map_start_lba =
         rst.data.inode_valid_block_start_lba + rst.data.inode_valid_blocks_cnt;
+    rst.data.inode_chunk_map_blocks_cnt =
+        (rst.data.inode_chunks_cnt * sizeof(uint64_t) + rst.data.block_size - 1) /
+        rst.data.block_size;
+    rst.data.allocated_inode_chunks = 0;
+
+    rst.data.journal_start_lba =
+        rst.data.inode_chunk_map_start_lba + rst.data.inode_chunk_map_blocks_cnt;
+    rst.data.journal_blocks_cnt = std::clamp<uint64_t>(
+        rst.data.total_blocks / 128, JOURNAL_MIN_BLOCKS, JOURNAL_MAX_BLOCKS);
+    rst.data.journal_seq = 1;
+    rst.data.clean_shutdown = 0;
+
+    // 快照独占位图与盘块位图一一对应
+    rst.data.cow_bitmap_start_lba = rst.data.journal_start_lba + rst.data.journal_blocks_cnt;
+    rst.data.cow_bitmap_blocks_cnt = rst.data.bitmap_blocks_cnt;
 
     rst.data.basic_blocks_cnt = rst.data.super_blocks_cnt + rst.data.bitmap_blocks_cnt +
-                                rst.data.inode_valid_blocks_cnt + rst.data.inode_blocks_cnt;
+                                rst.data.inode_valid_blocks_cnt +
+                                rst.data.inode_chunk_map_blocks_cnt + rst.data.journal_blocks_cnt +
+                                rst.data.cow_bitmap_blocks_cnt;
 
     rst.data.diritem_size = DIRITEM_SIZE;
 
@@ -4,13 +4,33 @@
 constexpr uint32_t BLOCK_SIZE = 16<<10;
 
 constexpr uint64_t MAGIC_NUMBER = 0xEA6191;
-constexpr uint64_t VERSION = 7;
+constexpr uint64_t VERSION = 14;
 
 constexpr uint16_t DIRITEM_SIZE = 64;
 
 constexpr uint32_t FILENAME_SIZE = 54;
 
 constexpr uint32_t INODE_SIZE = 512;
-constexpr uint32_t INODE_DATA_SIZE = INODE_SIZE - 38;
+constexpr uint32_t INODE_DATA_SIZE = INODE_SIZE - 50;
+constexpr uint32_t INODE_LOCALITY_BLOCKS = 4;
+constexpr uint32_t INODE_CHUNK_BLOCKS = 64;
+
+constexpr uint32_t FRAGMENT_SIZE = 1 << 10;
+constexpr uint32_t FRAGMENTS_PER_BLOCK = BLOCK_SIZE / FRAGMENT_SIZE;
+constexpr uint32_t FRAGMENT_MAX_SIZE = BLOCK_SIZE / 2;
+
+constexpr uint32_t LAZY_INIT_FLAGS_SIZE = 8192;
+
+constexpr uint32_t JOURNAL_MIN_BLOCKS = 4096;
+constexpr uint32_t JOURNAL_MAX_BLOCKS = 16384;
+constexpr uint32_t JOURNAL_REPLAY_READ_BLOCKS = 256;
+
+constexpr uint32_t MAX_SNAPSHOTS = 16;
+
+constexpr uint32_t ASYNC_IO_QUEUE_DEPTH = 4096;
+
+constexpr uint32_t DIRTY_TRACK_PRUNE_MIN = 1024;
+
+constexpr uint32_t INDEX_SCAN_BATCH = 1024;
 
 constexpr uint32_t BTree_M = (BLOCK_SIZE - 16) >> 4;
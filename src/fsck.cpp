@@ -0,0 +1,46 @@
+#include "FileDisk.hpp"
+#include "FsChecker.hpp"
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv) {
+    spdlog::set_level(spdlog::level::warn);
+
+    std::string path = argc > 1 ? argv[1] : "vdisk_test.img";
+    unsigned threads = argc > 2 ? std::stoul(argv[2]) : std::thread::hardware_concurrency();
+
+    // FileDisk 在大小不匹配时会清空镜像, 因此按实际文件大小打开
+    if (!std::filesystem::exists(path)) {
+        std::cerr << std::format("镜像不存在: {}\n", path);
+        return 2;
+    }
+    uint64_t size_bytes = std::filesystem::file_size(path);
+    if (size_bytes == 0 || size_bytes % (1ULL << 30)) {
+        std::cerr << std::format("镜像大小 {} B 不是整 GB\n", size_bytes);
+        return 2;
+    }
+    auto disk = std::make_shared<FileDisk>(size_bytes >> 30, BLOCK_SIZE, path);
+
+    auto start = std::chrono::steady_clock::now();
+    FsChecker checker(disk, threads);
+    auto report = checker.run();
+    double duration =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const auto &msg : report.messages)
+        std::cout << msg << "\n";
+    std::cout << "==================== fsck ====================\n";
+    std::cout << std::format("Image         : {}\n", path);
+    std::cout << std::format("INodes        : {}\n", report.inodes_checked);
+    std::cout << std::format("Blocks in use : {}\n", report.blocks_referenced);
+    std::cout << std::format("Errors        : {}\n", report.errors);
+    std::cout << std::format("Time          : {:.2f}s\n", duration);
+    std::cout << "==============================================\n";
+
+    return report.errors ? 1 : 0;
+}
@@ -1,14 +1,18 @@
 #include "FileDisk.hpp"
 #include "FileSys.hpp"
+#include "FsChecker.hpp"
 #include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <coroutine>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <random>
 #include <string>
 #include <thread>
@@ -18,6 +22,9 @@
 const std::string DISK_PATH = "vdisk_test.img";
 const uint32_t DISK_SIZE_GB = 4096;        // 4TB 用于提供足够的测试空间
 const size_t CHUNK_SIZE = 1 * 1024 * 1024; // 1MB Buffer
+// 功能测试使用独立的小镜像, 卸载后可做离线一致性检查
+const std::string FEATURE_DISK_PATH = "vdisk_feature.img";
+const uint32_t FEATURE_DISK_SIZE_GB = 8;
 // ===========================================
 
 // ================= 日志初始化 =================
@@ -97,6 +104,88 @@ void fill_random(std::vector<uint8_t> &buf) {
     }
 }
 
+// 工具：离线检查已卸载的镜像, 有错误时打印并退出; 返回被引用的盘块数
+uint64_t expect_clean(std::shared_ptr<IDisk> disk, const std::string &stage) {
+    auto report = FsChecker(disk).run();
+    if (report.errors) {
+        for (auto &msg : report.messages)
+            std::cerr << msg << std::endl;
+        std::cerr << "致命错误: " << stage << " 后一致性检查失败!" << std::endl;
+        exit(1);
+    }
+    return report.blocks_referenced;
+}
+
+// 工具：直接读取已卸载镜像的超级块, 得到空闲盘块数
+uint64_t free_blocks(std::shared_ptr<IDisk> disk) {
+    SuperBlock sb;
+    disk->read_block(0, reinterpret_cast<char *>(&sb));
+    return sb.data.free_blocks;
+}
+
+// 工具：从 0 开始读出文件内容, 最多 max_len 字节
+std::vector<uint8_t> read_file(FileSys &fs, uint64_t fd, uint64_t max_len) {
+    std::vector<uint8_t> buf(max_len);
+    buf.resize(fs.pread(fd, 0, buf));
+    return buf;
+}
+
+// 工具：文件内容与大小须与 model 一致, 否则打印所在阶段并退出
+void expect_content(FileSys &fs, uint64_t fd, const std::vector<uint8_t> &model,
+                    const std::string &stage) {
+    if (read_file(fs, fd, model.size() + 1) != model) {
+        spdlog::error("{}: 文件内容与预期不符!", stage);
+        exit(1);
+    }
+}
+
+// 工具：带易失写缓存的磁盘, 写入在 flush 前只留在内存中. crash() 模拟掉电:
+// 丢弃未 flush 的写入, 之后的写入 (如卸载时的回写) 也不再到达底层磁盘
+class CrashDisk : public IDisk {
+public:
+    CrashDisk(std::shared_ptr<IDisk> _disk)
+        : IDisk(_disk->get_disk_size(), BLOCK_SIZE), disk(_disk) {}
+    void clear() override { disk->clear(); }
+    void read_block(uint64_t lba, char *buffer) override {
+        if (auto it = pending.find(lba); it != pending.end())
+            std::memcpy(buffer, it->second.data(), BLOCK_SIZE);
+        else
+            disk->read_block(lba, buffer);
+    }
+    void write_block(uint64_t lba, const char *data) override {
+        if (!down)
+            pending[lba].assign(data, data + BLOCK_SIZE);
+    }
+    void flush() override {
+        if (down)
+            return;
+        for (auto &[lba, data] : pending)
+            disk->write_block(lba, data.data());
+        pending.clear();
+        disk->flush();
+    }
+    void crash() {
+        down = true;
+        pending.clear();
+    }
+
+private:
+    std::shared_ptr<IDisk> disk;
+    std::map<uint64_t, std::vector<char>> pending;
+    bool down = false;
+};
+
+// 立即开始执行, 结束后自行销毁的协程, 用于发起异步 I/O
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
 // ================= 压力测试类 =================
 class StressTester {
     std::shared_ptr<FileSys> fs;
@@ -348,9 +437,979 @@ public:
         fs->remove_dir(breadth_root);
         std::cout << "   广度测试通过。" << std::endl;
 
+        // C. 批量删除与目录压缩
+        std::cout << "-> C. 批量删除与目录压缩 (remove_many 2000 Files)..." << std::endl;
+        std::string spool = root + "/spool";
+        fs->create_dir(spool);
+        std::vector<std::string> even_names, odd_names;
+        for (int i = 0; i < 2000; ++i) {
+            std::string name = "job_" + std::to_string(i);
+            if (!fs->create_file(spool + "/" + name))
+                exit(1);
+            (i % 2 ? odd_names : even_names).push_back(name);
+        }
+        if (fs->remove_many(spool, even_names) != even_names.size()) {
+            spdlog::error("批量删除数量不符!");
+            exit(1);
+        }
+        for (int i = 0; i < 2000; ++i) {
+            if (fs->has_file(spool + "/job_" + std::to_string(i)) != (i % 2 == 1)) {
+                spdlog::error("目录压缩后目录项错误: job_{}", i);
+                exit(1);
+            }
+        }
+        fs->remove_many(spool, odd_names);
+        if (!fs->remove_dir(spool)) {
+            spdlog::error("批量删除后目录非空: {}", spool);
+            exit(1);
+        }
+        std::cout << "   批量删除测试通过。" << std::endl;
+
         fs->remove_dir(root);
     }
 
+    // 快照: 修改后快照内容保持不变, 快照只读
+    void test_snapshot(std::shared_ptr<IDisk> disk) {
+        std::cout << "\n[Test 9] 快照与写时复制 (Snapshot & COW)..." << std::endl;
+        std::string dir = "/snapshot";
+        fs->create_dir(dir);
+        std::vector<uint8_t> origin(1024 * 1024);
+        fill_random(origin);
+        fs->create_file(dir + "/data.bin");
+        auto fd = fs->open(dir + "/data.bin").value();
+        fs->write(fd, origin);
+        fs->close(fd);
+
+        auto snap_id = fs->snapshot();
+        if (!snap_id) {
+            spdlog::error("创建快照失败!");
+            exit(1);
+        }
+
+        std::vector<uint8_t> patch(64 * 1024, 0xAB);
+        fd = fs->open(dir + "/data.bin").value();
+        fs->seek(fd, 300 * 1024);
+        fs->write(fd, patch);
+        fs->close(fd);
+        fs->create_file(dir + "/after.txt");
+
+        auto snap = FileSys::open_snapshot(disk, snap_id.value());
+        if (!snap || snap->has_file(dir + "/after.txt") || snap->create_file(dir + "/x")) {
+            spdlog::error("快照内容或只读检查失败!");
+            exit(1);
+        }
+        std::vector<uint8_t> buf(origin.size());
+        auto snap_fd = snap->open(dir + "/data.bin").value();
+        snap->read(snap_fd, buf);
+        snap->close(snap_fd);
+        if (buf != origin) {
+            spdlog::error("快照数据被修改!");
+            exit(1);
+        }
+        fd = fs->open(dir + "/data.bin").value();
+        fs->read(fd, buf);
+        fs->close(fd);
+        if (!std::equal(patch.begin(), patch.end(), buf.begin() + 300 * 1024)) {
+            spdlog::error("写时复制后数据错误!");
+            exit(1);
+        }
+        std::cout << "   快照测试通过。" << std::endl;
+    }
+
+    // 10. 多线程并发读写: 各线程读写独立文件, 并在同一目录下并发创建文件
+    void test_concurrency() {
+        std::cout << "\n[Test 10] 多线程并发读写 (Concurrency)..." << std::endl;
+        std::string dir = "/concurrency";
+        fs->create_dir(dir);
+        const size_t total_mb = 256;
+        double base = 0;
+        for (size_t threads : {1, 2, 4, 8}) {
+            std::atomic<bool> ok = true;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; t++) {
+                workers.emplace_back([&, t] {
+                    std::string path = dir + "/t" + std::to_string(threads) + "_" +
+                                       std::to_string(t);
+                    fs->create_file(path);
+                    auto fd = fs->open(path).value();
+                    std::vector<uint8_t> chunk(1024 * 1024, static_cast<uint8_t>(t + 1));
+                    const size_t mb = total_mb / threads;
+                    for (size_t i = 0; i < mb; i++)
+                        fs->write(fd, chunk);
+                    fs->seek(fd, 0);
+                    std::vector<uint8_t> buf(chunk.size());
+                    for (size_t i = 0; i < mb; i++)
+                        if (fs->read(fd, buf) != buf.size() || buf != chunk)
+                            ok = false;
+                    fs->close(fd);
+                    for (int i = 0; i < 200; i++)
+                        fs->create_file(path + "_" + std::to_string(i));
+                });
+            }
+            for (auto &worker : workers)
+                worker.join();
+            auto end = std::chrono::high_resolution_clock::now();
+            double duration = std::chrono::duration<double>(end - start).count();
+            if (!ok) {
+                spdlog::error("并发读写数据校验失败!");
+                exit(1);
+            }
+            if (threads == 1)
+                base = duration;
+            std::cout << "   " << threads << " 线程: " << std::fixed << std::setprecision(2)
+                      << (2.0 * total_mb / duration) << " MB/s, 加速比 " << (base / duration)
+                      << std::endl;
+        }
+        auto cursor = fs->opendir(dir);
+        size_t cnt = 0;
+        for (auto items = fs->readdir(*cursor); !items.empty(); items = fs->readdir(*cursor))
+            cnt += items.size();
+        if (cnt != 2 + 15 * 201) {
+            spdlog::error("并发创建文件数量错误: {}", cnt);
+            exit(1);
+        }
+
+        // 读取目录期间另一线程在同一目录中反复创建和删除, 读到的每一批目录项都应完整
+        std::atomic<bool> stop = false;
+        std::thread churn([&] {
+            for (int i = 0; !stop; i = (i + 1) % 500) {
+                fs->create_file(dir + "/churn_" + std::to_string(i));
+                fs->remove_file(dir + "/churn_" + std::to_string((i + 250) % 500));
+            }
+        });
+        for (int round = 0; round < 50; round++) {
+            cursor = fs->opendir(dir);
+            for (auto items = fs->readdir(*cursor); !items.empty();
+                 items = fs->readdir(*cursor)) {
+                for (const auto &item : items) {
+                    std::string name(item.name, strnlen(item.name, sizeof(item.name)));
+                    if (name != "." && name != ".." && !name.starts_with("t") &&
+                        !name.starts_with("churn_")) {
+                        spdlog::error("并发修改时读到损坏的目录项: {}", name);
+                        exit(1);
+                    }
+                }
+            }
+        }
+        stop = true;
+        churn.join();
+        std::cout << "   并发测试通过。" << std::endl;
+    }
+
+    // 11. 协程异步 I/O: 同时发起远超队列深度的请求, 每个请求打开文件, 写入一条记录后读回校验
+    void test_async_io() {
+        std::cout << "\n[Test 11] 协程异步 I/O (Async I/O)..." << std::endl;
+        std::string dir = "/async";
+        fs->create_dir(dir);
+        const size_t files = 64, requests = 3 * ASYNC_IO_QUEUE_DEPTH;
+        for (size_t i = 0; i < files; i++)
+            fs->create_file(dir + "/f" + std::to_string(i));
+
+        std::atomic<size_t> done = 0;
+        std::atomic<bool> ok = true;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < requests; i++)
+            async_record(dir + "/f" + std::to_string(i % files), i, done, ok);
+        while (done < requests)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto end = std::chrono::high_resolution_clock::now();
+
+        if (!ok) {
+            spdlog::error("异步读写数据校验失败!");
+            exit(1);
+        }
+        double duration = std::chrono::duration<double>(end - start).count();
+        std::cout << "   " << requests << " 个请求: " << std::fixed << std::setprecision(0)
+                  << (requests / duration) << " ops/s" << std::endl;
+        std::cout << "   异步 I/O 测试通过。" << std::endl;
+    }
+
+    DetachedTask async_record(std::string path, size_t i, std::atomic<size_t> &done,
+                              std::atomic<bool> &ok) {
+        std::vector<uint8_t> record(4096, static_cast<uint8_t>(i * 7 + 1));
+        std::vector<uint8_t> buf(record.size());
+        auto fd = co_await fs->async_open(path);
+        const uint64_t offset = i / 64 * record.size();
+        if (!fd || !co_await fs->async_write(*fd, offset, record) ||
+            co_await fs->async_read(*fd, offset, buf) != buf.size() || buf != record)
+            ok = false;
+        if (fd)
+            fs->close(*fd);
+        done++;
+    }
+
+    // 12. 克隆后首次写入只复制被修改的索引路径, 源文件不变, 删除后镜像一致
+    void test_clone_cow() {
+        std::cout << "\n[Test 12] 克隆与索引树写时复制 (Clone & Path COW)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        std::vector<uint8_t> origin(64 * 1024 * 1024);
+        fill_random(origin);
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->format();
+            fs->create_file("/src.bin");
+            auto fd = fs->open("/src.bin").value();
+            fs->write(fd, origin);
+            fs->close(fd);
+            if (!fs->clone_file("/src.bin", "/dst.bin")) {
+                spdlog::error("克隆文件失败!");
+                exit(1);
+            }
+            // 目标已存在, 源不存在或是目录时克隆失败, 且不留下空的目标文件
+            fs->create_dir("/dir");
+            if (fs->clone_file("/src.bin", "/dst.bin") || fs->clone_file("/none", "/x.bin") ||
+                fs->clone_file("/dir", "/y.bin") || fs->has_file("/x.bin") ||
+                fs->has_file("/y.bin")) {
+                spdlog::error("克隆失败时目标文件状态错误!");
+                exit(1);
+            }
+            fs->remove_dir("/dir");
+        }
+        const uint64_t cloned = expect_clean(disk, "克隆");
+
+        std::vector<uint8_t> patch(50000, 0x5A);
+        const uint64_t patch_offset = 1024 * 1024;
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            auto fd = fs->open("/dst.bin").value();
+            fs->pwrite(fd, patch_offset, patch);
+            fs->close(fd);
+
+            std::vector<uint8_t> buf(origin.size());
+            fd = fs->open("/src.bin").value();
+            fs->read(fd, buf);
+            fs->close(fd);
+            if (buf != origin) {
+                spdlog::error("写入克隆后源文件被修改!");
+                exit(1);
+            }
+            fd = fs->open("/dst.bin").value();
+            fs->read(fd, buf);
+            fs->close(fd);
+            std::copy(patch.begin(), patch.end(), origin.begin() + patch_offset);
+            if (buf != origin) {
+                spdlog::error("克隆文件写入后数据错误!");
+                exit(1);
+            }
+        }
+        // 4 个数据块加上根到叶子的路径
+        const uint64_t copied = expect_clean(disk, "克隆后写入") - cloned;
+        if (copied > 16) {
+            spdlog::error("克隆后首次写入复制了 {} 个盘块!", copied);
+            exit(1);
+        }
+
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            if (!fs->remove_file("/src.bin") || !fs->remove_file("/dst.bin")) {
+                spdlog::error("删除克隆文件失败!");
+                exit(1);
+            }
+        }
+        expect_clean(disk, "删除克隆");
+        std::cout << "   首次写入复制 " << copied << " 个盘块, 克隆测试通过。" << std::endl;
+    }
+
+    // 13. fsync 后掉电: 不经 sync / 卸载回写, 重新挂载后 fsync 过的数据与大小仍在
+    void test_fsync_durability() {
+        std::cout << "\n[Test 13] fsync 掉电持久性 (Fsync Durability)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        std::vector<uint8_t> data(3 * 1024 * 1024 + 1234);
+        fill_random(data);
+        {
+            auto crash_disk = std::make_shared<CrashDisk>(disk);
+            auto fs = std::make_shared<FileSys>(crash_disk);
+            fs->format();
+            fs->create_file("/durable.bin");
+            fs->create_file("/volatile.bin");
+            fs->sync();
+
+            auto fd = fs->open("/durable.bin").value();
+            fs->write(fd, data);
+            fs->fsync(fd);
+            auto vfd = fs->open("/volatile.bin").value();
+            fs->write(vfd, data);
+            crash_disk->crash();
+        }
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            auto fd = fs->open("/durable.bin").value();
+            std::vector<uint8_t> buf(data.size() + 100);
+            const size_t n = fs->read(fd, buf);
+            buf.resize(n);
+            if (buf != data) {
+                spdlog::error("fsync 后掉电, 数据或大小丢失: 读回 {} 字节, 应为 {}.", n,
+                              data.size());
+                exit(1);
+            }
+            fs->close(fd);
+        }
+        expect_clean(disk, "掉电恢复");
+        std::cout << "   fsync 过的 " << data.size() << " 字节在掉电后完整恢复。" << std::endl;
+    }
+
+    // 14. 批量创建与查询: 重复, 非法, 超长与不存在的名字
+    void test_batch_ops() {
+        std::cout << "\n[Test 14] 批量创建与查询 (mkdir_many / stat_many)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        const std::string long_name(80, 'L');
+        const std::string stored_long = long_name.substr(0, FILENAME_SIZE - 1);
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->format();
+            std::vector<std::string> names;
+            for (int i = 0; i < 300; i++)
+                names.push_back("d" + std::to_string(i));
+            names.insert(names.end(), {"d5", "d5", "", ".", "..", "a/b", long_name});
+
+            const uint32_t root_links = fs->stat_many("/", {"."})[0]->link_cnt;
+            const size_t created = fs->mkdir_many("/", names);
+            if (created != 301 || fs->mkdir_many("/", names) != 0) {
+                spdlog::error("mkdir_many 创建数量错误: {}", created);
+                exit(1);
+            }
+            // 每个子目录的 ".." 使父目录链接数加一
+            if (fs->stat_many("/", {"."})[0]->link_cnt != root_links + created) {
+                spdlog::error("mkdir_many 后父目录链接数错误!");
+                exit(1);
+            }
+
+            auto stats = fs->stat_many("/", {"d0", "missing", "d5", "d5", long_name, stored_long,
+                                             "d299", "d300"});
+            const bool expect[] = {true, false, true, true, true, true, true, false};
+            for (size_t i = 0; i < stats.size(); i++) {
+                if (stats[i].has_value() != expect[i] ||
+                    (stats[i] && stats[i]->file_type != FileType::Directory)) {
+                    spdlog::error("stat_many 第 {} 个结果错误!", i);
+                    exit(1);
+                }
+            }
+            if (stats[2]->ID != stats[3]->ID || stats[4]->ID != stats[5]->ID) {
+                spdlog::error("stat_many 对同名查询返回了不同的 INode!");
+                exit(1);
+            }
+
+            std::vector<std::string> files = {"f0", "f1", "f1", "f2"};
+            if (fs->create_many("/d7", files) != 3 || !fs->has_file("/d7/f2")) {
+                spdlog::error("create_many 子目录中创建失败!");
+                exit(1);
+            }
+            for (auto &name : files)
+                fs->remove_file("/d7/" + name);
+            for (int i = 0; i < 300; i += 2)
+                fs->remove_dir("/d" + std::to_string(i));
+        }
+        expect_clean(disk, "批量创建");
+        std::cout << "   批量创建与查询测试通过。" << std::endl;
+    }
+
+    // 15. 小文件碎片存储: 占用盘块, 增长迁移, 截断回退, 快照与克隆
+    void test_small_files() {
+        std::cout << "\n[Test 15] 小文件碎片存储 (Fragment Storage)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        std::make_shared<FileSys>(disk)->format();
+        const uint64_t free_before = free_blocks(disk);
+
+        const int FILE_COUNT = 2000;
+        std::vector<std::string> names;
+        std::vector<std::vector<uint8_t>> contents;
+        for (int i = 0; i < FILE_COUNT; i++) {
+            names.push_back("f" + std::to_string(i));
+            contents.emplace_back(600 + rng() % 3000);
+            fill_random(contents.back());
+        }
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->create_dir("/s");
+            fs->create_many("/s", names);
+            for (int i = 0; i < FILE_COUNT; i++) {
+                auto fd = fs->open("/s/" + names[i]).value();
+                fs->pwrite(fd, 0, contents[i]);
+                fs->close(fd);
+            }
+        }
+        // 每个文件独占盘块时需 FILE_COUNT 块
+        expect_clean(disk, "小文件写入");
+        const uint64_t used = free_before - free_blocks(disk);
+        if (used > FILE_COUNT / 3) {
+            spdlog::error("{} 个小文件占用了 {} 个盘块!", FILE_COUNT, used);
+            exit(1);
+        }
+
+        auto fs = std::make_shared<FileSys>(disk);
+        auto storage = [&](const std::string &name) {
+            return fs->stat_many("/s", {name})[0]->storage_type;
+        };
+        auto verify = [&](const std::string &path, const std::vector<uint8_t> &expect) {
+            auto fd = fs->open(path).value();
+            std::vector<uint8_t> buf(expect.size() + 1);
+            buf.resize(fs->pread(fd, 0, buf));
+            fs->close(fd);
+            return buf == expect;
+        };
+        auto fail = [](const std::string &what) {
+            spdlog::error("小文件测试失败: {}", what);
+            exit(1);
+        };
+        // 重新挂载后逐一读回, 共用碎片块的各文件互不覆盖
+        for (int i = 0; i < FILE_COUNT; i++)
+            if (storage(names[i]) != StorageType::Fragment || !verify("/s/" + names[i], contents[i]))
+                fail("小文件 " + names[i] + " 读回内容错误");
+
+        // 逐次追加, 其间穿插新文件占住相邻碎片, 迫使原位扩展失败而迁移到其它碎片块
+        std::vector<uint8_t> grow, piece(1000);
+        fs->create_file("/s/grow");
+        auto fd = fs->open("/s/grow").value();
+        while (grow.size() + piece.size() <= FRAGMENT_MAX_SIZE) {
+            fill_random(piece);
+            fs->pwrite(fd, grow.size(), piece);
+            grow.insert(grow.end(), piece.begin(), piece.end());
+            const std::string neighbour = "n" + std::to_string(grow.size());
+            fs->create_file("/s/" + neighbour);
+            auto nfd = fs->open("/s/" + neighbour).value();
+            fs->pwrite(nfd, 0, piece);
+            fs->close(nfd);
+            if (storage("grow") != StorageType::Fragment || !verify("/s/grow", grow))
+                fail("追加后碎片文件内容错误");
+        }
+        fs->pwrite(fd, grow.size(), piece);
+        grow.insert(grow.end(), piece.begin(), piece.end());
+        if (storage("grow") != StorageType::Direct || !verify("/s/grow", grow))
+            fail("超过碎片上限后未转为 Direct");
+
+        fs->truncate(fd, 3000);
+        grow.resize(3000);
+        if (storage("grow") != StorageType::Fragment || !verify("/s/grow", grow))
+            fail("截断后未回到碎片存储");
+        fs->truncate(fd, 100);
+        grow.resize(100);
+        if (storage("grow") != StorageType::Inline || !verify("/s/grow", grow))
+            fail("截断后未回到内联存储");
+        fs->close(fd);
+
+        // 快照之后的写入不影响快照中的内容
+        fs->sync();
+        const uint64_t snap = fs->snapshot().value();
+        std::vector<uint8_t> patch(500, 0xAB);
+        for (int i = 0; i < 10; i++) {
+            fd = fs->open("/s/" + names[i]).value();
+            fs->pwrite(fd, 100, patch);
+            fs->close(fd);
+        }
+        fs->create_file("/s/after");
+        fd = fs->open("/s/after").value();
+        fs->pwrite(fd, 0, patch);
+        fs->close(fd);
+        fs->sync();
+        {
+            auto snap_fs = FileSys::open_snapshot(disk, snap);
+            for (int i = 0; i < 10; i++) {
+                auto sfd = snap_fs->open("/s/" + names[i]).value();
+                std::vector<uint8_t> buf(contents[i].size() + 1);
+                buf.resize(snap_fs->pread(sfd, 0, buf));
+                snap_fs->close(sfd);
+                if (buf != contents[i])
+                    fail("快照中的小文件被之后的写入修改");
+            }
+        }
+        for (int i = 0; i < 10; i++)
+            std::copy(patch.begin(), patch.end(), contents[i].begin() + 100);
+        if (!verify("/s/" + names[0], contents[0]) || !verify("/s/after", patch))
+            fail("快照后写入的内容错误");
+
+        // 克隆碎片文件得到独立的副本
+        fs->clone_file("/s/" + names[20], "/s/copy");
+        fd = fs->open("/s/copy").value();
+        fs->pwrite(fd, 0, patch);
+        fs->close(fd);
+        std::vector<uint8_t> copy = contents[20];
+        std::copy(patch.begin(), patch.end(), copy.begin());
+        if (!verify("/s/copy", copy) || !verify("/s/" + names[20], contents[20]))
+            fail("克隆碎片文件后内容错误");
+
+        fs.reset();
+        expect_clean(disk, "小文件");
+        std::cout << "   " << FILE_COUNT << " 个小文件占用 " << used << " 个盘块, 碎片存储测试通过。"
+                  << std::endl;
+    }
+
+    // 16. 预分配: 未写入的预留块读出全零, 区间中部写入与追加, 空间不足时整体回滚
+    void test_fallocate() {
+        std::cout << "\n[Test 16] 预分配 (fallocate)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        std::make_shared<FileSys>(disk)->format();
+        const uint64_t free_before = free_blocks(disk);
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            auto check = [&](uint64_t fd, const std::vector<uint8_t> &model, const char *stage) {
+                if (read_file(*fs, fd, model.size() + 1) != model) {
+                    spdlog::error("预分配测试失败: {}", stage);
+                    exit(1);
+                }
+            };
+            fs->create_file("/pre.bin");
+            auto fd = fs->open("/pre.bin").value();
+            std::vector<uint8_t> model(100000);
+            fill_random(model);
+            fs->pwrite(fd, 0, model);
+
+            model.resize(10 * 1024 * 1024, 0);
+            if (!fs->fallocate(fd, 0, model.size()))
+                spdlog::error("预分配失败!");
+            check(fd, model, "预分配越过已写入数据");
+
+            // 已写入区间内打洞后再预分配, 新块须清零
+            fs->punch_hole(fd, BLOCK_SIZE, 4 * BLOCK_SIZE);
+            std::fill(model.begin() + BLOCK_SIZE, model.begin() + 5 * BLOCK_SIZE, 0);
+            fs->fallocate(fd, 0, 100000);
+            check(fd, model, "已写入区间内的预分配");
+
+            std::vector<uint8_t> patch(40000);
+            fill_random(patch);
+            const uint64_t mid = 5 * 1024 * 1024 + 123;
+            fs->pwrite(fd, mid, patch);
+            std::copy(patch.begin(), patch.end(), model.begin() + mid);
+            check(fd, model, "预分配区间中部写入");
+
+            fs->pwrite(fd, model.size(), patch);
+            model.insert(model.end(), patch.begin(), patch.end());
+            const uint64_t gap = model.size() + 3 * BLOCK_SIZE + 5;
+            fs->fallocate(fd, gap, 1024 * 1024);
+            model.resize(gap + 1024 * 1024, 0);
+            fs->pwrite(fd, model.size(), patch);
+            model.insert(model.end(), patch.begin(), patch.end());
+            check(fd, model, "追加与末尾之后的预分配");
+
+            // 超出磁盘容量: 失败且文件不变, 已分配的盘块全部归还
+            if (fs->fallocate(fd, 0, 2ull * FEATURE_DISK_SIZE_GB * (1ull << 30))) {
+                spdlog::error("超出磁盘容量的预分配未失败!");
+                exit(1);
+            }
+            check(fd, model, "预分配失败后");
+            fs->close(fd);
+            fs->remove_file("/pre.bin");
+        }
+        expect_clean(disk, "预分配");
+        if (free_blocks(disk) != free_before) {
+            spdlog::error("预分配测试后空闲盘块 {} 少于初始的 {}!", free_blocks(disk),
+                          free_before);
+            exit(1);
+        }
+        std::cout << "   预分配测试通过。" << std::endl;
+    }
+
+    // 17. 截断与打洞: 缩短后延长读出全零, 跨多个索引叶子打洞, 克隆与快照后截断
+    void test_truncate_punch() {
+        std::cout << "\n[Test 17] 截断与打洞 (Truncate & Punch Hole)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        std::make_shared<FileSys>(disk)->format();
+        const uint64_t MB = 1024 * 1024;
+        // 40MB 为 2560 个块, 索引树有多个叶子
+        std::vector<uint8_t> model(40 * MB);
+        fill_random(model);
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->create_file("/t.bin");
+            auto fd = fs->open("/t.bin").value();
+            fs->pwrite(fd, 0, model);
+
+            fs->truncate(fd, 3 * MB + 100);
+            model.resize(3 * MB + 100);
+            fs->truncate(fd, 20 * MB);
+            model.resize(20 * MB, 0);
+            expect_content(*fs, fd, model, "缩短后延长");
+
+            // 重新写满, 之后打洞的区间内全部是已映射的块
+            model.resize(40 * MB);
+            fill_random(model);
+            fs->pwrite(fd, 0, model);
+            expect_content(*fs, fd, model, "延长后写入");
+            fs->close(fd);
+        }
+        expect_clean(disk, "截断与延长");
+
+        const uint64_t free_before_punch = free_blocks(disk);
+        const uint64_t punch_at = 5 * MB + 7, punch_len = 25 * MB;
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            auto fd = fs->open("/t.bin").value();
+            fs->punch_hole(fd, punch_at, punch_len);
+            std::fill(model.begin() + punch_at, model.begin() + punch_at + punch_len, 0);
+            expect_content(*fs, fd, model, "跨叶子打洞");
+            // 两端不完整的块清零后保留, 其间的整块释放
+            if (fs->seek_hole(fd, 0) != 5 * MB + BLOCK_SIZE || fs->seek_data(fd, 6 * MB) != 30 * MB) {
+                spdlog::error("打洞后空洞位置错误!");
+                exit(1);
+            }
+            fs->close(fd);
+        }
+        expect_clean(disk, "打洞");
+        if (free_blocks(disk) < free_before_punch + punch_len / BLOCK_SIZE - 2) {
+            spdlog::error("打洞未释放盘块: {} -> {}", free_before_punch, free_blocks(disk));
+            exit(1);
+        }
+
+        std::optional<uint64_t> snap;
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->clone_file("/t.bin", "/c.bin");
+            fs->sync();
+            snap = fs->snapshot();
+            auto fd = fs->open("/t.bin").value();
+            auto cfd = fs->open("/c.bin").value();
+            std::vector<uint8_t> clone_model(model.begin(), model.begin() + 10 * MB);
+            clone_model.resize(12 * MB, 0);
+            fs->truncate(cfd, 10 * MB);
+            fs->truncate(cfd, 12 * MB);
+            fs->truncate(fd, MB);
+            expect_content(*fs, cfd, clone_model, "截断克隆文件");
+            expect_content(*fs, fd, std::vector<uint8_t>(model.begin(), model.begin() + MB),
+                           "截断克隆源文件");
+            fs->close(fd);
+            fs->close(cfd);
+            fs->sync();
+
+            auto snap_fs = FileSys::open_snapshot(disk, snap.value());
+            auto sfd = snap_fs->open("/t.bin").value();
+            expect_content(*snap_fs, sfd, model, "快照中的截断前内容");
+            snap_fs->close(sfd);
+        }
+        expect_clean(disk, "克隆与快照后截断");
+        std::cout << "   截断与打洞测试通过。" << std::endl;
+    }
+
+    // 18. 稀疏文件: 开头, 中间与末尾的空洞, 预分配未写入的尾部, 文件末尾及之后的偏移
+    void test_sparse_seek() {
+        std::cout << "\n[Test 18] 稀疏文件定位 (seek_data / seek_hole)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        const uint64_t MB = 1024 * 1024;
+        auto fs = std::make_shared<FileSys>(disk);
+        fs->format();
+        fs->create_file("/sparse.bin");
+        auto fd = fs->open("/sparse.bin").value();
+
+        std::vector<uint8_t> model(8 * MB, 0);
+        auto put = [&](uint64_t offset, uint64_t len) {
+            std::vector<uint8_t> data(len);
+            fill_random(data);
+            fs->pwrite(fd, offset, data);
+            std::copy(data.begin(), data.end(), model.begin() + offset);
+        };
+        auto expect_pos = [](std::optional<uint64_t> got, std::optional<uint64_t> want,
+                             const char *what) {
+            if (got != want) {
+                spdlog::error("{} 错误: 得到 {}, 应为 {}", what, got ? (int64_t)*got : -1,
+                              want ? (int64_t)*want : -1);
+                exit(1);
+            }
+        };
+        auto block_end = [](uint64_t pos) { return (pos + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE; };
+
+        // [0, 1MB) 空洞, 两段数据, 其间与末尾到 8MB 为空洞
+        put(MB, 100000);
+        put(5 * MB, 50000);
+        fs->truncate(fd, 8 * MB);
+        expect_content(*fs, fd, model, "稀疏文件");
+        expect_pos(fs->seek_data(fd, 0), MB, "开头空洞后的数据");
+        expect_pos(fs->seek_hole(fd, 0), 0, "开头的空洞");
+        expect_pos(fs->seek_hole(fd, MB), block_end(MB + 100000), "第一段数据后的空洞");
+        expect_pos(fs->seek_data(fd, MB + 200000), 5 * MB, "中间空洞后的数据");
+        expect_pos(fs->seek_data(fd, 5 * MB + 10), 5 * MB + 10, "数据中的偏移");
+        expect_pos(fs->seek_hole(fd, 5 * MB), 5 * MB + block_end(50000), "第二段数据后的空洞");
+        expect_pos(fs->seek_data(fd, 6 * MB), std::nullopt, "末尾空洞中的数据");
+        expect_pos(fs->seek_hole(fd, 7 * MB), 7 * MB, "末尾的空洞");
+
+        // 文件末尾及之后的偏移
+        expect_pos(fs->seek_data(fd, 8 * MB), std::nullopt, "文件末尾的数据");
+        expect_pos(fs->seek_hole(fd, 8 * MB), std::nullopt, "文件末尾的空洞");
+        expect_pos(fs->seek_hole(fd, 9 * MB), std::nullopt, "文件末尾之后的空洞");
+
+        // 预分配而未写入的尾部视为空洞, 读出全零; 写入其中之后其前的预留块成为数据
+        fs->fallocate(fd, 8 * MB, 2 * MB);
+        model.resize(10 * MB, 0);
+        expect_content(*fs, fd, model, "预分配尾部");
+        expect_pos(fs->seek_data(fd, 6 * MB), std::nullopt, "未写入尾部中的数据");
+        expect_pos(fs->seek_hole(fd, 8 * MB + 5), 8 * MB + 5, "未写入尾部的空洞");
+        put(9 * MB, 1000);
+        expect_content(*fs, fd, model, "写入预分配尾部");
+        expect_pos(fs->seek_data(fd, 6 * MB), 8 * MB, "写入后预留块中的数据");
+        expect_pos(fs->seek_hole(fd, 8 * MB), 9 * MB + BLOCK_SIZE, "写入后预留块后的空洞");
+
+        fs->close(fd);
+        fs.reset();
+        expect_clean(disk, "稀疏文件");
+        std::cout << "   稀疏文件定位测试通过。" << std::endl;
+    }
+
+    // 19. 向量化读写: 跨块边界的多段, 零长度段, 一次 writev 内 Inline→Direct→Index 的转换
+    void test_vectored_io() {
+        std::cout << "\n[Test 19] 向量化读写 (readv / writev)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        auto fs = std::make_shared<FileSys>(disk);
+        fs->format();
+        auto fail = [](const std::string &what) {
+            spdlog::error("向量化读写测试失败: {}", what);
+            exit(1);
+        };
+        auto storage = [&](const std::string &name) {
+            return fs->stat_many("/", {name})[0]->storage_type;
+        };
+        // 按 sizes 切分 buf, 返回各段的视图
+        auto split = [](std::vector<uint8_t> &buf, std::initializer_list<size_t> sizes) {
+            std::vector<std::span<uint8_t>> iov;
+            size_t pos = 0;
+            for (size_t len : sizes) {
+                iov.emplace_back(buf.data() + pos, len);
+                pos += len;
+            }
+            return iov;
+        };
+
+        // 空文件一次 writev 越过内联区与首块, 依次转为 Direct 与 Index
+        fs->create_file("/v.bin");
+        auto fd = fs->open("/v.bin").value();
+        std::vector<uint8_t> model(100 + 20000 + 30000 + 5);
+        fill_random(model);
+        auto wiov = split(model, {100, 0, 20000, 0, 30000, 5});
+        std::vector<std::span<const uint8_t>> cwiov(wiov.begin(), wiov.end());
+        if (!fs->writev(fd, cwiov) || storage("v.bin") != StorageType::Index)
+            fail("writev 后未转为 Index 存储");
+        expect_content(*fs, fd, model, "writev");
+
+        // 句柄偏移随 writev 前进; 只有零长度段时不改变文件
+        std::vector<std::span<const uint8_t>> empty_iov(3);
+        std::vector<uint8_t> more(BLOCK_SIZE + 1);
+        fill_random(more);
+        const std::span<const uint8_t> more_iov[] = {more};
+        if (!fs->writev(fd, empty_iov) || !fs->writev(fd, more_iov))
+            fail("追加 writev 失败");
+        model.insert(model.end(), more.begin(), more.end());
+        expect_content(*fs, fd, model, "追加 writev");
+
+        // 在块边界两侧的多段 pwritev
+        std::vector<uint8_t> patch(21000);
+        fill_random(patch);
+        auto piov = split(patch, {7000, 0, 7000, 7000});
+        std::vector<std::span<const uint8_t>> cpiov(piov.begin(), piov.end());
+        fs->pwritev(fd, BLOCK_SIZE - 3000, cpiov);
+        std::copy(patch.begin(), patch.end(), model.begin() + BLOCK_SIZE - 3000);
+        expect_content(*fs, fd, model, "跨块边界的 pwritev");
+
+        // 各段长度不同且含零长度段的 readv / preadv, 拼接后与文件内容一致
+        std::vector<uint8_t> got(model.size() + 100);
+        auto riov = split(got, {BLOCK_SIZE - 4, 0, 10, 40000, 0, got.size() - BLOCK_SIZE - 40006});
+        fs->seek(fd, 0);
+        if (fs->readv(fd, riov) != model.size() ||
+            !std::equal(model.begin(), model.end(), got.begin()))
+            fail("readv 内容错误");
+        std::fill(got.begin(), got.end(), 0);
+        auto piov_read = split(got, {3, 0, BLOCK_SIZE, 7});
+        if (fs->preadv(fd, 1000, piov_read) != BLOCK_SIZE + 10 ||
+            !std::equal(got.begin(), got.begin() + BLOCK_SIZE + 10, model.begin() + 1000))
+            fail("preadv 内容错误");
+        fs->close(fd);
+
+        // 总长不超过碎片上限时一次 writev 转为碎片存储
+        fs->create_file("/small.bin");
+        fd = fs->open("/small.bin").value();
+        std::vector<uint8_t> small(3000);
+        fill_random(small);
+        auto siov = split(small, {400, 0, 400, 2200});
+        std::vector<std::span<const uint8_t>> csiov(siov.begin(), siov.end());
+        if (!fs->writev(fd, csiov) || storage("small.bin") != StorageType::Fragment)
+            fail("小文件 writev 后未转为碎片存储");
+        expect_content(*fs, fd, small, "小文件 writev");
+        fs->close(fd);
+
+        fs.reset();
+        expect_clean(disk, "向量化读写");
+        std::cout << "   向量化读写测试通过。" << std::endl;
+    }
+
+    // 20. 区间复制: 对齐整块共享, 非对齐按字节复制, 同文件重叠拒绝, 源空洞不占用盘块
+    void test_copy_range() {
+        std::cout << "\n[Test 20] 区间复制 (copy_range)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        const uint64_t MB = 1024 * 1024;
+        auto fail = [](const std::string &what) {
+            spdlog::error("区间复制测试失败: {}", what);
+            exit(1);
+        };
+        std::vector<uint8_t> model(10 * MB);
+        fill_random(model);
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->format();
+            fs->create_file("/src.bin");
+            auto fd = fs->open("/src.bin").value();
+            fs->pwrite(fd, 0, model);
+            fs->close(fd);
+        }
+        const uint64_t free_before = free_blocks(disk);
+
+        auto fs = std::make_shared<FileSys>(disk);
+        auto src = fs->open("/src.bin").value();
+        fs->create_file("/aligned.bin");
+        auto aligned = fs->open("/aligned.bin").value();
+        if (fs->copy_range(src, 0, aligned, 0, model.size()) != model.size())
+            fail("对齐复制的长度错误");
+        expect_content(*fs, aligned, model, "对齐复制");
+
+        fs->create_file("/bytes.bin");
+        auto bytes = fs->open("/bytes.bin").value();
+        std::vector<uint8_t> expect(333, 0);
+        expect.insert(expect.end(), model.begin() + 1000, model.begin() + 1000 + 100000);
+        if (fs->copy_range(src, 1000, bytes, 333, 100000) != 100000)
+            fail("非对齐复制的长度错误");
+        expect_content(*fs, bytes, expect, "非对齐复制");
+
+        if (fs->copy_range(src, 0, src, BLOCK_SIZE, 2 * BLOCK_SIZE) != 0)
+            fail("同一文件内重叠的区间未被拒绝");
+        expect_content(*fs, src, model, "拒绝重叠复制后");
+
+        // 源文件开头的数据之后全是空洞; 目标原有数据的对应区间须清零, 末尾随源延长
+        fs->create_file("/sparse.bin");
+        auto sparse = fs->open("/sparse.bin").value();
+        std::vector<uint8_t> sparse_model(8 * MB, 0);
+        std::copy(model.begin(), model.begin() + 20000, sparse_model.begin());
+        fs->pwrite(sparse, 0, std::span<const uint8_t>(model.data(), 20000));
+        fs->truncate(sparse, sparse_model.size());
+        fs->create_file("/dst.bin");
+        auto dst = fs->open("/dst.bin").value();
+        fs->pwrite(dst, 0, std::span<const uint8_t>(model.data(), 3 * MB));
+        if (fs->copy_range(sparse, 0, dst, 0, sparse_model.size()) != sparse_model.size())
+            fail("复制稀疏文件的长度错误");
+        expect_content(*fs, dst, sparse_model, "复制稀疏文件");
+        if (fs->seek_data(dst, 2 * BLOCK_SIZE).has_value())
+            fail("源文件的空洞在目标中占用了盘块");
+
+        for (auto fd : {src, aligned, bytes, sparse, dst})
+            fs->close(fd);
+        fs.reset();
+        // 对齐复制只共享盘块, 其余文件加起来只有几十个块
+        const uint64_t used = free_before - free_blocks(disk);
+        if (used > 64)
+            fail("复制后新占用了 " + std::to_string(used) + " 个盘块");
+        expect_clean(disk, "区间复制");
+        std::cout << "   复制 10MB 新占用 " << used << " 个盘块, 区间复制测试通过。" << std::endl;
+    }
+
+    // 21. 离线一致性检查: 干净的镜像无错误, 人为破坏超级块计数与位图后能够发现
+    void test_fsck() {
+        std::cout << "\n[Test 21] 离线一致性检查 (fsck)..." << std::endl;
+        auto disk =
+            std::make_shared<FileDisk>(FEATURE_DISK_SIZE_GB, BLOCK_SIZE, FEATURE_DISK_PATH);
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->format();
+            fs->create_dir("/d");
+            std::vector<std::string> names;
+            for (int i = 0; i < 50; i++)
+                names.push_back("f" + std::to_string(i));
+            fs->create_many("/d", names);
+            for (int i = 0; i < 50; i++) {
+                // 内联, 碎片, Direct 与 Index 存储都有
+                std::vector<uint8_t> data(100 + i * i * 1000);
+                fill_random(data);
+                auto fd = fs->open("/d/" + names[i]).value();
+                fs->pwrite(fd, 0, data);
+                fs->close(fd);
+            }
+            fs->clone_file("/d/f49", "/d/clone");
+            fs->snapshot();
+            fs->remove_file("/d/f10");
+        }
+        auto report = FsChecker(disk).run();
+        expect_clean(disk, "干净镜像");
+        auto expect_corrupt = [&](const char *what) {
+            if (FsChecker(disk).run().errors == 0) {
+                spdlog::error("fsck 未发现{}!", what);
+                exit(1);
+            }
+        };
+
+        SuperBlock sb;
+        disk->read_block(0, reinterpret_cast<char *>(&sb));
+        const SuperBlock good_sb = sb;
+        sb.data.free_blocks += 7;
+        disk->write_block(0, reinterpret_cast<const char *>(&sb));
+        expect_corrupt("超级块中错误的空闲块数");
+        disk->write_block(0, reinterpret_cast<const char *>(&good_sb));
+        expect_clean(disk, "恢复超级块");
+
+        // 位图第一块末尾的盘块未被使用, 将其标记为已分配即为泄漏
+        std::vector<char> bitmap(BLOCK_SIZE), good_bitmap(BLOCK_SIZE);
+        disk->read_block(sb.data.bitmap_block_start_lba, good_bitmap.data());
+        bitmap = good_bitmap;
+        const uint64_t leaked = sb.data.bits_per_block - 1;
+        bitmap[leaked / 8] |= 1 << (7 - leaked % 8);
+        disk->write_block(sb.data.bitmap_block_start_lba, bitmap.data());
+        expect_corrupt("位图中泄漏的盘块");
+        disk->write_block(sb.data.bitmap_block_start_lba, good_bitmap.data());
+        expect_clean(disk, "恢复位图");
+
+        std::cout << "   检查了 " << report.inodes_checked << " 个 INode, 一致性检查测试通过。"
+                  << std::endl;
+    }
+
+    // 22. 快照后空间耗尽: 目录与 INode 块组无法写时复制时删除失败且不做任何修改,
+    // 腾出空间后可以正常删除, 快照内容始终不变
+    void test_snapshot_disk_full() {
+        std::cout << "\n[Test 22] 快照后空间耗尽 (Snapshot & Disk Full)..." << std::endl;
+        auto disk = std::make_shared<FileDisk>(2, BLOCK_SIZE, FEATURE_DISK_PATH);
+        std::vector<std::string> names;
+        for (int i = 0; i < 3000; i++)
+            names.push_back("f" + std::to_string(i));
+        uint64_t snap_id = 0;
+        {
+            auto fs = std::make_shared<FileSys>(disk);
+            fs->format();
+            fs->create_dir("/d");
+            fs->create_many("/d", names);
+            snap_id = fs->snapshot().value();
+
+            fs->create_file("/fill.bin");
+            auto fd = fs->open("/fill.bin").value();
+            std::vector<uint8_t> chunk(1024 * 1024, 0x11), block(BLOCK_SIZE, 0x22);
+            uint64_t offset = 0;
+            while (fs->pwrite(fd, offset, chunk))
+                offset += chunk.size();
+            while (fs->pwrite(fd, offset, block))
+                offset += block.size();
+            fs->close(fd);
+
+            if (fs->remove_file("/d/f7") || fs->remove_many("/d", {"f1", "f2999"}) != 0 ||
+                !fs->has_file("/d/f7") || !fs->has_file("/d/f1") || !fs->has_file("/d/f2999")) {
+                spdlog::error("空间耗尽时删除目录项应失败且不做修改!");
+                exit(1);
+            }
+            if (!fs->remove_file("/fill.bin") || !fs->remove_file("/d/f7") ||
+                fs->remove_many("/d", {"f1", "f2999"}) != 2) {
+                spdlog::error("腾出空间后删除失败!");
+                exit(1);
+            }
+        }
+        expect_clean(disk, "快照后空间耗尽");
+        auto snap = FileSys::open_snapshot(disk, snap_id);
+        for (const auto &name : names) {
+            if (!snap->has_file("/d/" + name)) {
+                spdlog::error("快照中的文件 {} 丢失!", name);
+                exit(1);
+            }
+        }
+        std::cout << "   快照后空间耗尽测试通过。" << std::endl;
+    }
+
     // 7. 综合性能基准测试 (Performance Benchmarks)
     void test_performance_benchmarks() {
         std::cout << "\n[Test 7] 综合性能基准测试 (Performance Benchmarks)..." << std::endl;
@@ -396,6 +1455,31 @@ public:
                       << " Ops/sec (" << duration << "s)" << std::endl;
         }
 
+        // Benchmark 2b: Batch Create 10,000 Files + Stat
+        {
+            std::string batch_dir = base_dir + "/batch";
+            if (!fs->has_dir(batch_dir))
+                fs->create_dir(batch_dir);
+            std::vector<std::string> names;
+            for (int i = 0; i < 10000; ++i)
+                names.push_back("f_" + std::to_string(i));
+
+            std::cout << "-> 2b. 批量创建 10,000 个文件 (create_many)..." << std::flush;
+            auto start = std::chrono::high_resolution_clock::now();
+            size_t created = fs->create_many(batch_dir, names);
+            auto stats = fs->stat_many(batch_dir, names);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            if (created != names.size() ||
+                !std::ranges::all_of(stats, [](const auto &attr) { return attr.has_value(); })) {
+                spdlog::error("批量创建文件失败: {}", created);
+                exit(1);
+            }
+            double duration = std::chrono::duration<double>(end - start).count();
+            std::cout << " Done. " << std::fixed << std::setprecision(2) << (10000.0 / duration)
+                      << " Ops/sec (" << duration << "s)" << std::endl;
+        }
+
         // Benchmark 3: Sequential Write 1GB
         std::string seq_file = base_dir + "/seq_1gb.bin";
         fs->create_file(seq_file);
@@ -437,39 +1521,42 @@ public:
                       << " MB/s (" << duration << "s)" << std::endl;
         }
 
-        // // Benchmark 5: Random Read 1MB x 1000 (3GB Range)
-        // std::string rand_file = base_dir + "/rand_3gb.bin";
-        // fs->create_file(rand_file);
-        // {
-        //     auto fd = fs->open(rand_file).value();
-        //     // 扩展文件到 3GB (Sparse 方式，只写最后一个字节)
-        //     fs->seek(fd, 3ULL * 1024 * 1024 * 1024 - 1);
-        //     std::vector<uint8_t> b(1, 0);
-        //     fs->write(fd, b);
-        //
-        //     std::cout << "-> 5. 随机读取 1MB x 1000次 (3GB Range)..." << std::flush;
-        //     std::vector<uint8_t> buf(1024 * 1024);
-        //     std::uniform_int_distribution<uint64_t> dist(0,
-        //                                                  3ULL * 1024 * 1024 * 1024 - 1024 * 1024);
-        //
-        //     auto start = std::chrono::high_resolution_clock::now();
-        //
-        //     for (int i = 0; i < 1000; ++i) {
-        //         uint64_t offset = dist(rng);
-        //         fs->seek(fd, offset);
-        //         fs->read(fd, buf);
-        //     }
-        //
-        //     fs->close(fd);
-        //     auto end = std::chrono::high_resolution_clock::now();
-        //     double duration = std::chrono::duration<double>(end - start).count();
-        //     double total_mb = 1000.0;
-        //
-        //     std::cout << " Done. " << std::fixed << std::setprecision(2) << (total_mb / duration)
-        //               << " MB/s (" << duration << "s)";
-        //     std::cout << " [Avg Latency: " << (duration * 1000 / 1000.0) << " ms]" << std::endl;
-        // }
-        //
+        // Benchmark 5: Random Read 1MB x 1000 (3GB Range), 4 线程共享同一句柄
+        std::string rand_file = base_dir + "/rand_3gb.bin";
+        fs->create_file(rand_file);
+        {
+            auto fd = fs->open(rand_file).value();
+            // 扩展文件到 3GB (Sparse 方式，只写最后一个字节)
+            std::vector<uint8_t> b(1, 0);
+            fs->pwrite(fd, 3ULL * 1024 * 1024 * 1024 - 1, b);
+
+            std::cout << "-> 5. 随机读取 1MB x 1000次 (3GB Range)..." << std::flush;
+            auto start = std::chrono::high_resolution_clock::now();
+
+            std::vector<std::thread> workers;
+            for (int t = 0; t < 4; ++t) {
+                workers.emplace_back([&, t] {
+                    std::mt19937_64 local_rng(t);
+                    std::vector<uint8_t> buf(1024 * 1024);
+                    std::uniform_int_distribution<uint64_t> dist(
+                        0, 3ULL * 1024 * 1024 * 1024 - 1024 * 1024);
+                    for (int i = 0; i < 250; ++i)
+                        fs->pread(fd, dist(local_rng), buf);
+                });
+            }
+            for (auto &worker : workers)
+                worker.join();
+
+            fs->close(fd);
+            auto end = std::chrono::high_resolution_clock::now();
+            double duration = std::chrono::duration<double>(end - start).count();
+            double total_mb = 1000.0;
+
+            std::cout << " Done. " << std::fixed << std::setprecision(2) << (total_mb / duration)
+                      << " MB/s (" << duration << "s)";
+            std::cout << " [Avg Latency: " << (duration * 1000 / 1000.0) << " ms]" << std::endl;
+        }
+
         // 清理
         // fs->remove_dir(base_dir); // 可选：保留用于事后分析
     }
@@ -515,6 +1602,41 @@ int main() {
     std::cout << "8. 综合性能基准测试 (Performance Benchmarks) [NEW]" << std::endl;
     std::cout << "   - [Metric] 目录创建(10k)、文件创建(10k)、1GB顺序读写、3GB范围随机读取(1k次)。"
               << std::endl;
+    std::cout << "9. 快照与写时复制 (Snapshot & COW)" << std::endl;
+    std::cout << "   - [Action] 创建快照后改写文件，验证快照内容不变且只读。" << std::endl;
+    std::cout << "10. 多线程并发读写 (Concurrency)" << std::endl;
+    std::cout << "   - [Action] 1/2/4/8 线程读写独立文件共 256MB，同时在同一目录并发创建文件。"
+              << std::endl;
+    std::cout << "11. 协程异步 I/O (Async I/O)" << std::endl;
+    std::cout << "   - [Action] 同时发起 3 倍队列深度的协程请求，各自打开文件、写入记录并读回校验。"
+              << std::endl;
+    std::cout << "12. 克隆与索引树写时复制 (Clone & Path COW)" << std::endl;
+    std::cout << "   - [Action] 克隆 64MB 文件后改写，验证只复制被修改的路径且源文件不变。"
+              << std::endl;
+    std::cout << "13. fsync 掉电持久性 (Fsync Durability)" << std::endl;
+    std::cout << "   - [Action] fsync 后模拟掉电并重新挂载，验证数据与文件大小完整。" << std::endl;
+    std::cout << "14. 批量创建与查询 (mkdir_many / stat_many)" << std::endl;
+    std::cout << "   - [Action] 含重复、非法、超长与不存在名字的批量创建与查询。" << std::endl;
+    std::cout << "15. 小文件碎片存储 (Fragment Storage)" << std::endl;
+    std::cout << "   - [Action] 小文件共享碎片块，验证增长迁移、截断回退、快照与克隆。" << std::endl;
+    std::cout << "16. 预分配 (fallocate)" << std::endl;
+    std::cout << "   - [Action] 预留块读出全零、中部写入与追加，超出容量时回滚且不泄漏。" << std::endl;
+    std::cout << "17. 截断与打洞 (Truncate & Punch Hole)" << std::endl;
+    std::cout << "   - [Action] 缩短后延长读零、跨多个索引叶子打洞、克隆与快照后截断。" << std::endl;
+    std::cout << "18. 稀疏文件定位 (seek_data / seek_hole)" << std::endl;
+    std::cout << "   - [Action] 开头、中间、末尾的空洞，预分配未写入的尾部，末尾及之后的偏移。"
+              << std::endl;
+    std::cout << "19. 向量化读写 (readv / writev)" << std::endl;
+    std::cout << "   - [Action] 跨块边界的多段与零长度段，一次 writev 内完成存储类型转换。"
+              << std::endl;
+    std::cout << "20. 区间复制 (copy_range)" << std::endl;
+    std::cout << "   - [Action] 对齐整块共享、非对齐字节复制、拒绝重叠、源文件空洞不占盘块。"
+              << std::endl;
+    std::cout << "21. 离线一致性检查 (fsck)" << std::endl;
+    std::cout << "   - [Action] 干净镜像无错误，破坏超级块计数与位图后能被发现。" << std::endl;
+    std::cout << "22. 快照后空间耗尽 (Snapshot & Disk Full)" << std::endl;
+    std::cout << "   - [Action] 无法写时复制时删除失败且不做修改，腾出空间后正常删除，快照不变。"
+              << std::endl;
     std::cout << "================================================================================="
                  "========"
               << std::endl;
@@ -541,12 +1663,27 @@ int main() {
         tester.test_cache_thrashing();
         tester.test_directory_ops();
         tester.test_performance_benchmarks(); // 新增的性能测试
+        tester.test_snapshot(disk);
+        tester.test_concurrency();
+        tester.test_async_io();
+        tester.test_clone_cow();
+        tester.test_fsync_durability();
+        tester.test_batch_ops();
+        tester.test_small_files();
+        tester.test_fallocate();
+        tester.test_truncate_punch();
+        tester.test_sparse_seek();
+        tester.test_vectored_io();
+        tester.test_copy_range();
+        tester.test_fsck();
+        tester.test_snapshot_disk_full();
 
         std::cout << "\n[Info] 写入持久化验证令牌..." << std::endl;
         fs->create_file("/persistence.token");
         auto fd = fs->open("/persistence.token").value();
         std::string token = "PersistenceCheck:OK";
         fs->write(fd, std::span<uint8_t>((uint8_t *)token.data(), token.size()));
+        fs->fsync(fd);
         fs->close(fd);
     }
 